@@ -11,30 +11,42 @@
 
 namespace datasketches {
 
-AbstractCoupons::AbstractCoupons(const int lgConfigK, const TgtHllType tgtHllType, const CurMode curMode)
-  : HllSketchImpl(lgConfigK, tgtHllType, curMode) {}
+AbstractCoupons::AbstractCoupons(const int lgConfigK, const TgtHllType tgtHllType, const CurMode curMode,
+                                 std::pmr::memory_resource* resource)
+  : HllSketchImpl(lgConfigK, tgtHllType, curMode, resource) {}
 
 AbstractCoupons::~AbstractCoupons() {}
 
 double AbstractCoupons::getCompositeEstimate() { return getEstimate(); }
 
+double AbstractCoupons::getImprovedEstimate() { return getEstimate(); }
+
 double AbstractCoupons::getEstimate() {
-  const int couponCount = getCouponCount();
+  return couponEstimate(getCouponCount());
+}
+
+double AbstractCoupons::getLowerBound(const int numStdDev) {
+  return couponLowerBound(getCouponCount(), numStdDev);
+}
+
+double AbstractCoupons::getUpperBound(const int numStdDev) {
+  return couponUpperBound(getCouponCount(), numStdDev);
+}
+
+double AbstractCoupons::couponEstimate(const int couponCount) {
   const double est = CubicInterpolation::usingXAndYTables(couponCount);
   return fmax(est, couponCount);
 }
 
-double AbstractCoupons::getLowerBound(const int numStdDev) {
+double AbstractCoupons::couponLowerBound(const int couponCount, const int numStdDev) {
   HllUtil::checkNumStdDev(numStdDev);
-  const int couponCount = getCouponCount();
   const double est = CubicInterpolation::usingXAndYTables(couponCount);
   const double tmp = est / (1.0 + (numStdDev * HllUtil::COUPON_RSE));
   return fmax(tmp, couponCount);
 }
 
-double AbstractCoupons::getUpperBound(const int numStdDev) {
+double AbstractCoupons::couponUpperBound(const int couponCount, const int numStdDev) {
   HllUtil::checkNumStdDev(numStdDev);
-  const int couponCount = getCouponCount();
   const double est = CubicInterpolation::usingXAndYTables(couponCount);
   const double tmp = est / (1.0 - (numStdDev * HllUtil::COUPON_RSE));
   return fmax(tmp, couponCount);
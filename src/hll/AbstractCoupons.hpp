@@ -11,7 +11,8 @@ namespace datasketches {
 
 class AbstractCoupons : public HllSketchImpl {
   public:
-    AbstractCoupons(const int lgConfigK, const TgtHllType tgtHllType, const CurMode curMode);
+    AbstractCoupons(const int lgConfigK, const TgtHllType tgtHllType, const CurMode curMode,
+                    std::pmr::memory_resource* resource);
     virtual ~AbstractCoupons();
 
     virtual int getCouponCount() = 0;
@@ -21,10 +22,16 @@ class AbstractCoupons : public HllSketchImpl {
 
     virtual double getEstimate();
     virtual double getCompositeEstimate();
+    virtual double getImprovedEstimate();
     virtual double getUpperBound(const int numStdDev);
     virtual double getLowerBound(const int numStdDev);
 
     virtual int getUpdatableSerializationBytes();
+
+    // estimators as a function of the coupon count alone
+    static double couponEstimate(const int couponCount);
+    static double couponLowerBound(const int couponCount, const int numStdDev);
+    static double couponUpperBound(const int couponCount, const int numStdDev);
     //virtual int getCompactSerializationBytes();
 
     //virtual int getPreInts();
@@ -12,31 +12,33 @@
 
 namespace datasketches {
 
-AuxHashMap::AuxHashMap(int lgAuxArrInts,int lgConfigK)
-  : lgConfigK(lgConfigK),
+AuxHashMap::AuxHashMap(int lgAuxArrInts, int lgConfigK, std::pmr::memory_resource* resource)
+  : ResourceAllocated(resource),
+    lgConfigK(lgConfigK),
     lgAuxArrInts(lgAuxArrInts),
     auxCount(0) {
   const int numItems = 1 << lgAuxArrInts;
-  auxIntArr = new int[numItems];
+  auxIntArr = newArray<int>(numItems);
   std::fill(auxIntArr, auxIntArr + numItems, 0);
 }
 
 AuxHashMap::AuxHashMap(AuxHashMap& that)
-  : lgConfigK(that.lgConfigK),
+  : ResourceAllocated(that.resource),
+    lgConfigK(that.lgConfigK),
     lgAuxArrInts(that.lgAuxArrInts),
     auxCount(that.auxCount) {
   const int numItems = 1 << lgAuxArrInts;
-  auxIntArr = new int[numItems];
+  auxIntArr = newArray<int>(numItems);
   std::copy(that.auxIntArr, that.auxIntArr + numItems, auxIntArr);
 }
 
 AuxHashMap::~AuxHashMap() {
   // should be no way to have an object without a valid array
-  delete auxIntArr;
+  deleteArray(auxIntArr, 1 << lgAuxArrInts);
 }
 
 AuxHashMap* AuxHashMap::copy() {
-  return new AuxHashMap(*this);
+  return new (resource) AuxHashMap(*this);
 }
 
 int AuxHashMap::getAuxCount() {
@@ -111,19 +113,19 @@ void AuxHashMap::growAuxSpace() {
   int* oldArray = auxIntArr;
   const int oldArrLen = 1 << lgAuxArrInts;
   const int configKmask = (1 << lgConfigK) - 1;
-  const int newArrLen = ++lgAuxArrInts;
-  auxIntArr = new int[newArrLen];
+  const int newArrLen = 1 << ++lgAuxArrInts;
+  auxIntArr = newArray<int>(newArrLen);
   std::fill(auxIntArr, auxIntArr + newArrLen, 0);
   for (int i = 0; i < oldArrLen; ++i) {
     const int fetched = oldArray[i];
     if (fetched != HllUtil::EMPTY) {
       // find empty in new array
-      const int idx = find(auxIntArr, lgAuxArrInts, lgConfigK, fetched * configKmask);
+      const int idx = find(auxIntArr, lgAuxArrInts, lgConfigK, fetched & configKmask);
       auxIntArr[~idx] = fetched;
     }
   }
 
-  delete oldArray;
+  deleteArray(oldArray, oldArrLen);
 }
 
 //Searches the Aux arr hash table for an empty or a matching slotNo depending on the context.
@@ -5,15 +5,17 @@
 
 #pragma once
 
+#include "HllUtil.hpp"
 #include "IntArrayPairIterator.hpp"
+#include "ResourceAllocated.hpp"
 
 #include <memory>
 
 namespace datasketches {
 
-class AuxHashMap {
+class AuxHashMap : public ResourceAllocated {
   public:
-    explicit AuxHashMap(int lgAuxArrInts, int lgConfigK);
+    explicit AuxHashMap(int lgAuxArrInts, int lgConfigK, std::pmr::memory_resource* resource);
     explicit AuxHashMap(AuxHashMap& that);
     virtual ~AuxHashMap();
 
@@ -26,6 +28,12 @@ class AuxHashMap {
     int getLgAuxArrInts();
     std::unique_ptr<PairIterator> getIterator();
 
+    /**
+     * Calls f(key, value) for every entry, in table order. Unlike getIterator() this
+     * allocates nothing and makes no virtual calls. f must not modify this map.
+     */
+    template<typename F> void forEachEntry(F&& f);
+
     void mustAdd(const int slotNo, const int value);
     int mustFindValueFor(const int slotNo);
     void mustReplace(const int slotNo, const int value);
@@ -43,4 +51,15 @@ class AuxHashMap {
     int* auxIntArr;
 };
 
+template<typename F>
+void AuxHashMap::forEachEntry(F&& f) {
+  const int len = 1 << lgAuxArrInts;
+  for (int i = 0; i < len; ++i) {
+    const int pair = auxIntArr[i];
+    if (pair != HllUtil::EMPTY) {
+      f(HllUtil::getLow26(pair), HllUtil::getValue(pair));
+    }
+  }
+}
+
 }
@@ -5,10 +5,19 @@
 
 #include "BaseHllSketch.hpp"
 #include "MurmurHash3.h"
+#include "MurmurHash3Fixed.hpp"
+#define XXH_INLINE_ALL
+#include "xxhash.h"
 #include "RelativeErrorTables.hpp"
 
 #include <cmath>
 #include <cassert>
+#include <algorithm>
+#include <cstring>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 namespace datasketches {
 
@@ -24,6 +33,10 @@ static int BaseHllSketch::getSerializationVersion(BaseHllSketch sketch) {
 }
 */
 
+HashType BaseHllSketch::getHashType() {
+  return hashType;
+}
+
 bool BaseHllSketch::isEstimationMode() {
   return true;
 }
@@ -38,54 +51,173 @@ std::ostream& BaseHllSketch::to_string(std::ostream& os, const bool summary, con
 }
 
 
-int BaseHllSketch::coupon(const uint64_t hash[]) {
-  int addr26 = (int) (hash[0] & KEY_MASK_26);
-  int lz = getNumberOfLeadingZeros(hash[1]);
-  int value = ((lz > 62 ? 62 : lz) + 1); 
-  return (value << KEY_BITS_26) | addr26;
+int BaseHllSketch::coupon(const uint64_t hash[2]) {
+  const int addr26 = (int) (hash[0] & KEY_MASK_26);
+  // Setting bit 1 caps the count at 62 and guarantees a non-zero input,
+  // so no clamp or zero check is needed
+  const int lz = getNumberOfLeadingZeros(hash[1] | 2);
+  return HllUtil::pair(addr26, lz + 1);
 }
 
-int BaseHllSketch::getNumberOfLeadingZeros(const uint64_t x) {
-  if (x == 0)
-    return 64;
-
-  // we know at least some 1 bit, so iterate until it's in leftmost position
-  // -- making endian assumptions here
+inline int BaseHllSketch::getNumberOfLeadingZeros(const uint64_t x) {
+  if (x == 0) { return 64; }
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_clzll(x);
+#elif defined(_MSC_VER) && defined(_M_X64)
+  unsigned long idx;
+  _BitScanReverse64(&idx, x);
+  return 63 - (int) idx;
+#else
   int n = 0;
   uint64_t val = x;
-  while ((val & 0x8000000000000000L) == 0) {
+  while ((val & 0x8000000000000000ULL) == 0) {
     ++n;
     val <<= 1;
   }
   return n;
+#endif
 }
 
 void BaseHllSketch::update(const std::string datum) {
   if (datum.empty()) { return; }
   uint64_t hashResult[2];
-  hash(datum.c_str(), datum.length(), DEFAULT_UPDATE_SEED, hashResult);
+  hash(hashType, datum.c_str(), datum.length(), DEFAULT_UPDATE_SEED, hashResult);
   couponUpdate(coupon(hashResult));
 }
 
 void BaseHllSketch::update(const uint64_t datum) {
-  update(&datum, sizeof(datum));
+  uint64_t hashResult[2];
+  hash(hashType, &datum, sizeof(datum), DEFAULT_UPDATE_SEED, hashResult);
+  couponUpdate(coupon(hashResult));
 }
 
 void BaseHllSketch::update(const double datum) {
-  double d = ((datum == 0.0) ? 0.0 : datum); // canonicalize -0.0, 0.0
-  d = (std::isnan(d) ? NAN : d); // canonicalize NaN, although portability to Java not guaranteed
-  update(&d, sizeof(d));
+  const double d = HllUtil::canonicalize(datum);
+  uint64_t hashResult[2];
+  hash(hashType, &d, sizeof(d), DEFAULT_UPDATE_SEED, hashResult);
+  couponUpdate(coupon(hashResult));
 }
 
 void BaseHllSketch::update(const void* data, const size_t len) {
   if (data == nullptr) { return; }
   uint64_t hashResult[2];
-  hash(data, len, DEFAULT_UPDATE_SEED, hashResult);
+  hash(hashType, data, len, DEFAULT_UPDATE_SEED, hashResult);
   couponUpdate(coupon(hashResult));
 }
 
-void BaseHllSketch::hash(const void* key, const int keyLen, const uint64_t seed, uint64_t* result) {
-  MurmurHash3_x64_128(key, keyLen, DEFAULT_UPDATE_SEED, result);
+void BaseHllSketch::update(const uint64_t* data, const size_t len) {
+  if (data == nullptr) { return; }
+  int coupons[UPDATE_BLOCK_SIZE];
+  uint64_t hashResults[2 * UPDATE_BLOCK_SIZE];
+  for (size_t i = 0; i < len; i += UPDATE_BLOCK_SIZE) {
+    const int blockLen = (int) std::min<size_t>(UPDATE_BLOCK_SIZE, len - i);
+    hashKeys8(hashType, &data[i], blockLen, DEFAULT_UPDATE_SEED, hashResults);
+    for (int j = 0; j < blockLen; ++j) {
+      coupons[j] = coupon(&hashResults[2 * j]);
+    }
+    couponUpdate(coupons, blockLen);
+  }
+}
+
+void BaseHllSketch::update(const double* data, const size_t len) {
+  if (data == nullptr) { return; }
+  int coupons[UPDATE_BLOCK_SIZE];
+  uint64_t keys[UPDATE_BLOCK_SIZE];
+  uint64_t hashResults[2 * UPDATE_BLOCK_SIZE];
+  for (size_t i = 0; i < len; i += UPDATE_BLOCK_SIZE) {
+    const int blockLen = (int) std::min<size_t>(UPDATE_BLOCK_SIZE, len - i);
+    for (int j = 0; j < blockLen; ++j) {
+      const double d = HllUtil::canonicalize(data[i + j]);
+      std::memcpy(&keys[j], &d, sizeof(d));
+    }
+    hashKeys8(hashType, keys, blockLen, DEFAULT_UPDATE_SEED, hashResults);
+    for (int j = 0; j < blockLen; ++j) {
+      coupons[j] = coupon(&hashResults[2 * j]);
+    }
+    couponUpdate(coupons, blockLen);
+  }
+}
+
+void BaseHllSketch::update(const std::string_view* data, const size_t len) {
+  if (data == nullptr) { return; }
+  int coupons[UPDATE_BLOCK_SIZE];
+  uint64_t hashResult[2];
+  int numCoupons = 0;
+  for (size_t i = 0; i < len; ++i) {
+    if (data[i].empty()) { continue; }
+    hash(hashType, data[i].data(), data[i].length(), DEFAULT_UPDATE_SEED, hashResult);
+    coupons[numCoupons++] = coupon(hashResult);
+    if (numCoupons == UPDATE_BLOCK_SIZE) {
+      couponUpdate(coupons, numCoupons);
+      numCoupons = 0;
+    }
+  }
+  if (numCoupons > 0) {
+    couponUpdate(coupons, numCoupons);
+  }
+}
+
+void BaseHllSketch::update_hash(const uint64_t hash[2]) {
+  couponUpdate(coupon(hash));
+}
+
+void BaseHllSketch::update_coupons(const int* coupons, const size_t len) {
+  if (coupons == nullptr) { return; }
+  for (size_t i = 0; i < len; ++i) {
+    if ((coupons[i] != HllUtil::EMPTY) && (HllUtil::getValue(coupons[i]) == 0)) {
+      std::ostringstream oss;
+      oss << "Invalid coupon at index " << i << ": " << coupons[i];
+      throw std::invalid_argument(oss.str());
+    }
+  }
+
+  int block[UPDATE_BLOCK_SIZE];
+  int numCoupons = 0;
+  for (size_t i = 0; i < len; ++i) {
+    if (coupons[i] == HllUtil::EMPTY) { continue; }
+    block[numCoupons++] = coupons[i];
+    if (numCoupons == UPDATE_BLOCK_SIZE) {
+      couponUpdate(block, numCoupons);
+      numCoupons = 0;
+    }
+  }
+  if (numCoupons > 0) {
+    couponUpdate(block, numCoupons);
+  }
+}
+
+void BaseHllSketch::couponUpdate(const int coupons[], const int len) {
+  for (int i = 0; i < len; ++i) {
+    couponUpdate(coupons[i]);
+  }
+}
+
+// Inlined here so the fixed-width kernels and the dispatch fold into the callers
+inline void BaseHllSketch::hash(const HashType hashType, const void* key, const int keyLen,
+                                const uint64_t seed, uint64_t* result) {
+  if (hashType == HashType::XXH3_128) {
+    const XXH128_hash_t h = XXH3_128bits_withSeed(key, keyLen, seed);
+    result[0] = h.low64;
+    result[1] = h.high64;
+    return;
+  }
+  switch (keyLen) {
+    case 4:  MurmurHash3Fixed::hash4(key, seed, result); break;
+    case 8:  MurmurHash3Fixed::hash8(key, seed, result); break;
+    case 16: MurmurHash3Fixed::hash16(key, seed, result); break;
+    default: MurmurHash3_x64_128(key, keyLen, seed, result);
+  }
+}
+
+void BaseHllSketch::hashKeys8(const HashType hashType, const uint64_t* keys, const int numKeys,
+                              const uint64_t seed, uint64_t* results) {
+  if (hashType == HashType::MURMUR3) {
+    MurmurHash3_x64_128_keys8(keys, numKeys, seed, results);
+    return;
+  }
+  for (int i = 0; i < numKeys; ++i) {
+    hash(hashType, &keys[i], sizeof(uint64_t), seed, &results[2 * i]);
+  }
 }
 
 double BaseHllSketch::getRelErr(const bool upperBound, const bool unioned,
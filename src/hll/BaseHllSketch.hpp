@@ -7,6 +7,8 @@
 
 #include "HllUtil.hpp"
 
+#include <string_view>
+
 namespace datasketches {
 
 enum TgtHllType {
@@ -14,13 +16,26 @@ enum TgtHllType {
     HLL_8
 };
 
+/**
+ * The 128-bit hash applied to keys. Only MURMUR3 produces sketches compatible with
+ * the Java library; the others are for sketches that are never shared with it.
+ * Sketches built with different hashes cannot be unioned.
+ */
+enum HashType {
+    MURMUR3 = 0, // MurmurHash3_x64_128
+    XXH3_128     // xxHash XXH3_128bits_withSeed
+};
+
 class BaseHllSketch {
   public:
     static const int DEFAULT_K = 16;
 
-    explicit BaseHllSketch() {}
+    explicit BaseHllSketch(const HashType hashType = HashType::MURMUR3)
+      : hashType(hashType) {}
     virtual ~BaseHllSketch() {}
 
+    HashType getHashType();
+
     bool isEstimationMode();
 
     virtual double getCompositeEstimate() = 0;
@@ -67,23 +82,69 @@ class BaseHllSketch {
 
     void update(const void* data, const size_t len);
 
+    /**
+     * Present an array of keys to the sketch. This gives the same result as calling
+     * update() once per key, but keys are hashed a block at a time and each block of
+     * coupons is applied to the sketch with a single dispatch.
+     *
+     * @param data the keys to present
+     * @param len the number of keys
+     */
+    void update(const uint64_t* data, const size_t len);
+    void update(const double* data, const size_t len);
+    // empty strings are ignored, as with update(std::string)
+    void update(const std::string_view* data, const size_t len);
+
+    /**
+     * Present a key that was already hashed with this sketch's HashType and seed 9001.
+     * The result is the same as presenting the key itself, without hashing it again.
+     * @param hash the 128-bit hash as two 64-bit words, in the order MurmurHash3_x64_128
+     * writes them
+     */
+    void update_hash(const uint64_t hash[2]);
+
+    /**
+     * Apply coupons directly, e.g. ones produced by an external job with coupon().
+     * EMPTY (zero) coupons are skipped.
+     * @param coupons the coupons to apply
+     * @param len the number of coupons
+     * @throws std::invalid_argument if a non-empty coupon has a value of 0, in which case
+     * the sketch is left unchanged
+     */
+    void update_coupons(const int* coupons, const size_t len);
+
+    /**
+     * Returns the coupon for a 128-bit key hash: the low 26 bits of the first word are the
+     * address and the upper 6 bits hold 1 + the number of leading zeros of the second
+     * word, capped at 63. Coupons are independent of lgConfigK.
+     */
+    static int coupon(const uint64_t hash[2]);
 
   protected:
     virtual bool isOutOfOrderFlag() = 0;
 
     virtual void couponUpdate(int coupon) = 0;
 
+    // applies a block of coupons in order; default calls couponUpdate(int) per coupon
+    virtual void couponUpdate(const int coupons[], const int len);
+
     virtual enum CurMode getCurMode() = 0;
 
-    static const uint64_t DEFAULT_UPDATE_SEED = 9001L;
+    const HashType hashType;
+
+    static const uint64_t DEFAULT_UPDATE_SEED = HllUtil::DEFAULT_UPDATE_SEED;
     static const int KEY_BITS_26 = 26;
     static const int KEY_MASK_26 = (1 << KEY_BITS_26) - 1;
+    static const int UPDATE_BLOCK_SIZE = 64; // keys hashed per block in array updates
 
   private:
 
-    static void hash(const void* key, const int keyLen, const uint64_t seed, uint64_t* out);
+    static void hash(const HashType hashType, const void* key, const int keyLen,
+                     const uint64_t seed, uint64_t* out);
 
-    static int coupon(const uint64_t hash[]);
+    // hashes numKeys 8-byte keys into 2 * numKeys words, same results as hash() per key
+    static void hashKeys8(const HashType hashType, const uint64_t* keys, const int numKeys,
+                          const uint64_t seed, uint64_t* results);
 
     static int getNumberOfLeadingZeros(const uint64_t x);
 };
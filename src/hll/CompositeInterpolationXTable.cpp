@@ -7,10 +7,11 @@
 
 #include "HllUtil.hpp"
 #include "CompositeInterpolationXTable.hpp"
+#include "CubicInterpolation.hpp"
 
 namespace datasketches {
 
-static const int numXArrValues = 257;
+static constexpr int numXArrValues = 257;
 
 /**
  * 18 Values, index 0 is LgK = 4, index 17 is LgK = 21.
@@ -27,7 +28,7 @@ const int CompositeInterpolationXTable::get_x_arr_length(const int logK) {
   return numXArrValues;
 }
 
-static const double xArr[18][numXArrValues] = {
+static constexpr double xArr[18][numXArrValues] = {
 {
   10.767999803534, 11.237701481774, 11.722738717438, 12.223246391222,
   12.739366773787, 13.271184824495, 13.818759686650, 14.382159835785,
@@ -778,6 +779,40 @@ const double* const CompositeInterpolationXTable::get_x_arr(const int logK) {
   return xArr[logK - HllUtil::MIN_LOG_K];
 }
 
+typedef StraddleIndex<numXArrValues, 256> XArrIndex;
+
+/**
+ * One index per row of xArr, built at compile time.
+ */
+static constexpr XArrIndex xArrIndexes[18] = {
+  XArrIndex(xArr[0]),
+  XArrIndex(xArr[1]),
+  XArrIndex(xArr[2]),
+  XArrIndex(xArr[3]),
+  XArrIndex(xArr[4]),
+  XArrIndex(xArr[5]),
+  XArrIndex(xArr[6]),
+  XArrIndex(xArr[7]),
+  XArrIndex(xArr[8]),
+  XArrIndex(xArr[9]),
+  XArrIndex(xArr[10]),
+  XArrIndex(xArr[11]),
+  XArrIndex(xArr[12]),
+  XArrIndex(xArr[13]),
+  XArrIndex(xArr[14]),
+  XArrIndex(xArr[15]),
+  XArrIndex(xArr[16]),
+  XArrIndex(xArr[17])
+};
+
+int CompositeInterpolationXTable::find_straddle(const int logK, const double x) {
+  assert(logK >= HllUtil::MIN_LOG_K && logK <= HllUtil::MAX_LOG_K);
+  const double* row = xArr[logK - HllUtil::MIN_LOG_K];
+  assert(x >= row[0]);
+  if (x >= row[numXArrValues - 1]) { return numXArrValues - 2; }
+  return xArrIndexes[logK - HllUtil::MIN_LOG_K].find(x);
+}
+
 /*
     // log K = 4
 static const double xArrK4[] = {
@@ -13,6 +13,9 @@ class CompositeInterpolationXTable {
 
     static const double* const get_x_arr(const int logK);
     static const int get_x_arr_length(const int logK);
+
+    // Returns the i with x_arr[i] <= x < x_arr[i + 1], or length - 2 once x reaches the end.
+    static int find_straddle(const int logK, const double x);
 };
 
 }
@@ -0,0 +1,414 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#include "ConcurrentHllSketch.hpp"
+#include "HllArray.hpp"
+#include "HllUtil.hpp"
+
+#include <memory>
+#include <vector>
+
+namespace datasketches {
+
+/*
+ * How promotion stays lock-free and loses nothing:
+ *
+ * - A table's successor is elected by compare-and-swap on the table's own successor field,
+ *   so it is chosen exactly once. The winner and every loser then try to publish it, so
+ *   no writer ever waits for the winner.
+ * - A writer inserts into a table and then re-reads the current table. The winner replaces
+ *   the current table before copying the old one. Both use sequentially consistent
+ *   operations, so either the winner's copy sees the coupon or the writer sees the new
+ *   table and adds the coupon there itself. Adding a coupon twice changes nothing.
+ * - Until its copy is finished, a successor points back at the table being copied
+ *   (source), so readers see the coupons that have not been moved yet.
+ * - A table can fill up and be replaced while it is still being filled from its own source.
+ *   The winner therefore copies the whole chain of tables it can reach through source
+ *   links, not just the full table, before clearing its successor's link. An outer copy
+ *   that is still running never has coupons that only a cleared link led to.
+ * - A replaced table is freed only after its copy is finished and its source link is
+ *   cleared, once a count of the threads inside the sketch has been seen at zero. Every
+ *   thread that could still hold the table was counted before it became unreachable.
+ */
+
+static const int INSERTED = 0;
+static const int DUPLICATE = 1;
+static const int FULL = 2;
+
+struct ConcurrentHllSketch::CouponTable {
+  CouponTable(const int lgArrInts, CouponTable* source);
+  ~CouponTable();
+
+  // returns INSERTED, DUPLICATE or FULL, probing as CouponHashSet::find() does
+  int insert(const int coupon);
+  // same thresholds as CouponList and CouponHashSet
+  bool isOverloaded();
+  void collect(std::vector<int>& out);
+  // this table and every table still being copied into it, directly or not
+  void collectChain(std::vector<int>& out);
+
+  const int lgArrInts;
+  std::atomic<int>* coupons;
+  std::atomic<int> couponCount;
+  std::atomic<CouponTable*> source; // table still being copied into this one
+  std::atomic<CouponTable*> successor;
+  std::atomic<HllRegisters*> hllSuccessor;
+  CouponTable* nextRetired;
+};
+
+struct ConcurrentHllSketch::HllRegisters {
+  HllRegisters(const int lgConfigK, CouponTable* source);
+  ~HllRegisters();
+
+  std::atomic<uint8_t>* bytes;
+  std::atomic<CouponTable*> source; // table still being copied into the registers
+};
+
+ConcurrentHllSketch::CouponTable::CouponTable(const int lgArrInts, CouponTable* source)
+  : lgArrInts(lgArrInts),
+    coupons(new std::atomic<int>[1 << lgArrInts]()),
+    couponCount(0),
+    source(source),
+    successor(nullptr),
+    hllSuccessor(nullptr),
+    nextRetired(nullptr)
+{}
+
+ConcurrentHllSketch::CouponTable::~CouponTable() {
+  delete[] coupons;
+}
+
+int ConcurrentHllSketch::CouponTable::insert(const int coupon) {
+  const int arrMask = (1 << lgArrInts) - 1;
+  int probe = coupon & arrMask;
+  const int loopIndex = probe;
+  do {
+    int couponAtIdx = coupons[probe].load();
+    if (couponAtIdx == HllUtil::EMPTY) {
+      if (coupons[probe].compare_exchange_strong(couponAtIdx, coupon)) {
+        couponCount.fetch_add(1);
+        return INSERTED;
+      }
+      // lost the slot, couponAtIdx now holds the winner
+    }
+    if (couponAtIdx == coupon) {
+      return DUPLICATE;
+    }
+    const int stride = ((coupon & HllUtil::KEY_MASK_26) >> lgArrInts) | 1;
+    probe = (probe + stride) & arrMask;
+  } while (probe != loopIndex);
+  return FULL;
+}
+
+bool ConcurrentHllSketch::CouponTable::isOverloaded() {
+  const int len = 1 << lgArrInts;
+  if (lgArrInts == HllUtil::LG_INIT_LIST_SIZE) {
+    return couponCount.load() >= len;
+  }
+  return (HllUtil::RESIZE_DENOM * couponCount.load()) > (HllUtil::RESIZE_NUMER * len);
+}
+
+void ConcurrentHllSketch::CouponTable::collect(std::vector<int>& out) {
+  const int len = 1 << lgArrInts;
+  for (int i = 0; i < len; ++i) {
+    const int coupon = coupons[i].load();
+    if (coupon != HllUtil::EMPTY) {
+      out.push_back(coupon);
+    }
+  }
+}
+
+void ConcurrentHllSketch::CouponTable::collectChain(std::vector<int>& out) {
+  for (CouponTable* t = this; t != nullptr; t = t->source.load()) {
+    t->collect(out);
+  }
+}
+
+ConcurrentHllSketch::HllRegisters::HllRegisters(const int lgConfigK, CouponTable* source)
+  : bytes(new std::atomic<uint8_t>[1 << lgConfigK]()),
+    source(source)
+{}
+
+ConcurrentHllSketch::HllRegisters::~HllRegisters() {
+  delete[] bytes;
+}
+
+ConcurrentHllSketch::ConcurrentHllSketch(const int lgConfigK)
+  : ConcurrentHllSketch(lgConfigK, HashType::MURMUR3) {}
+
+ConcurrentHllSketch::ConcurrentHllSketch(const int lgConfigK, const HashType hashType)
+  : BaseHllSketch(hashType),
+    lgConfigK(HllUtil::checkLgK(lgConfigK)) {
+  init();
+}
+
+ConcurrentHllSketch::~ConcurrentHllSketch() {
+  freeAll();
+}
+
+void ConcurrentHllSketch::init() {
+  table.store(new CouponTable(HllUtil::LG_INIT_LIST_SIZE, nullptr));
+  registers.store(nullptr);
+  numActive.store(0);
+  retired.store(nullptr);
+}
+
+void ConcurrentHllSketch::freeAll() {
+  delete table.load();
+  delete registers.load();
+  CouponTable* next = retired.load();
+  while (next != nullptr) {
+    CouponTable* t = next;
+    next = t->nextRetired;
+    delete t;
+  }
+}
+
+void ConcurrentHllSketch::reset() {
+  freeAll();
+  init();
+}
+
+void ConcurrentHllSketch::couponUpdate(int coupon) {
+  HllRegisters* regs = registers.load(std::memory_order_acquire);
+  if (regs != nullptr) {
+    hllUpdate(regs, coupon, (1 << lgConfigK) - 1);
+    return;
+  }
+  enter();
+  sparseUpdate(coupon);
+  leave();
+}
+
+void ConcurrentHllSketch::sparseUpdate(const int coupon) {
+  while (true) {
+    CouponTable* current = table.load();
+    if (current == nullptr) { // HLL, the registers were published first
+      hllUpdate(registers.load(), coupon, (1 << lgConfigK) - 1);
+      return;
+    }
+    const int result = current->insert(coupon);
+    if ((result == FULL) || ((result == INSERTED) && current->isOverloaded())) {
+      promote(current);
+    }
+    if ((result != FULL) && (table.load() == current)) {
+      return;
+    }
+    // full, or replaced while inserting: add it to the successor as well
+  }
+}
+
+void ConcurrentHllSketch::hllUpdate(HllRegisters* regs, const int coupon,
+                                    const int configKmask) {
+  const int slotNo = HllUtil::getLow26(coupon) & configKmask;
+  const uint8_t newVal = (uint8_t) HllUtil::getValue(coupon);
+  std::atomic<uint8_t>& reg = regs->bytes[slotNo];
+  uint8_t curVal = reg.load(std::memory_order_relaxed);
+  while ((newVal > curVal)
+         && !reg.compare_exchange_weak(curVal, newVal, std::memory_order_relaxed)) {}
+}
+
+void ConcurrentHllSketch::promote(CouponTable* full) {
+  const bool toHll = (full->lgArrInts == HllUtil::LG_INIT_LIST_SIZE)
+      ? (lgConfigK < 8) : (full->lgArrInts == (lgConfigK - 3));
+  if (toHll) {
+    HllRegisters* regs = full->hllSuccessor.load();
+    bool won = false;
+    if (regs == nullptr) {
+      HllRegisters* candidate = new HllRegisters(lgConfigK, full);
+      won = full->hllSuccessor.compare_exchange_strong(regs, candidate);
+      if (won) { regs = candidate; } else { delete candidate; }
+    }
+    HllRegisters* noRegs = nullptr;
+    registers.compare_exchange_strong(noRegs, regs);
+    CouponTable* expected = full;
+    table.compare_exchange_strong(expected, nullptr);
+    if (won) {
+      std::vector<int> coupons;
+      full->collectChain(coupons);
+      const int configKmask = (1 << lgConfigK) - 1;
+      for (const int coupon : coupons) {
+        hllUpdate(regs, coupon, configKmask);
+      }
+      regs->source.store(nullptr);
+      retire(full);
+    }
+    return;
+  }
+
+  CouponTable* next = full->successor.load();
+  bool won = false;
+  if (next == nullptr) {
+    const int tgtLgArrInts = (full->lgArrInts == HllUtil::LG_INIT_LIST_SIZE)
+        ? HllUtil::LG_INIT_SET_SIZE : (full->lgArrInts + 1);
+    CouponTable* candidate = new CouponTable(tgtLgArrInts, full);
+    won = full->successor.compare_exchange_strong(next, candidate);
+    if (won) { next = candidate; } else { delete candidate; }
+  }
+  CouponTable* expected = full;
+  table.compare_exchange_strong(expected, next);
+  if (won) {
+    std::vector<int> coupons;
+    full->collectChain(coupons);
+    for (const int coupon : coupons) {
+      sparseUpdate(coupon);
+    }
+    next->source.store(nullptr);
+    retire(full);
+  }
+}
+
+void ConcurrentHllSketch::enter() {
+  numActive.fetch_add(1);
+}
+
+void ConcurrentHllSketch::leave() {
+  if ((numActive.fetch_sub(1) == 1) && (retired.load() != nullptr)) {
+    reclaim();
+  }
+}
+
+void ConcurrentHllSketch::retire(CouponTable* t) {
+  CouponTable* head = retired.load();
+  do {
+    t->nextRetired = head;
+  } while (!retired.compare_exchange_weak(head, t));
+}
+
+// Everything taken off the list was unreachable before it was taken, so if no thread is
+// inside the sketch afterwards, none can still hold it.
+void ConcurrentHllSketch::reclaim() {
+  CouponTable* list = retired.exchange(nullptr);
+  const bool quiescent = (numActive.load() == 0);
+  while (list != nullptr) {
+    CouponTable* t = list;
+    list = t->nextRetired;
+    if (quiescent) { delete t; } else { retire(t); }
+  }
+}
+
+HllSketch* ConcurrentHllSketch::copyAsHllSketch() {
+  const int configK = 1 << lgConfigK;
+  std::vector<int> coupons;
+  HllArray* hllArr = nullptr;
+
+  enter();
+  HllRegisters* regs = nullptr;
+  while (true) {
+    regs = registers.load();
+    if (regs != nullptr) { break; }
+    CouponTable* current = table.load();
+    if (current == nullptr) { continue; } // just promoted, the registers are published
+    coupons.clear();
+    current->collectChain(coupons);
+    if (table.load() == current) { break; } // nothing moved on while reading
+  }
+  if (regs != nullptr) {
+    // pending coupons first: once a source link is cleared its coupons are in the registers
+    coupons.clear();
+    CouponTable* pending = regs->source.load();
+    if (pending != nullptr) { pending->collectChain(coupons); }
+    hllArr = HllArray::newHll(lgConfigK, TgtHllType::HLL_8, std::pmr::get_default_resource());
+    for (int i = 0; i < configK; ++i) {
+      hllArr->hllByteArr[i] = regs->bytes[i].load(std::memory_order_relaxed);
+    }
+  }
+  leave();
+
+  HllSketch* sketch = new HllSketch(lgConfigK, TgtHllType::HLL_8, hashType);
+  if (hllArr == nullptr) {
+    sketch->update_coupons(coupons.data(), coupons.size());
+    return sketch;
+  }
+  for (const int coupon : coupons) {
+    const int slotNo = HllUtil::getLow26(coupon) & (configK - 1);
+    const int value = HllUtil::getValue(coupon);
+    if (value > hllArr->getSlot(slotNo)) {
+      hllArr->putSlot(slotNo, value);
+    }
+  }
+  hllArr->rebuildKxQ();
+  hllArr->putOutOfOrderFlag(true);
+  hllArr->putHipAccum(hllArr->getCompositeEstimate());
+  delete sketch->getImpl();
+  sketch->putImpl(hllArr);
+  return sketch;
+}
+
+double ConcurrentHllSketch::getEstimate() {
+  std::unique_ptr<HllSketch> snapshot(copyAsHllSketch());
+  return snapshot->getEstimate();
+}
+
+double ConcurrentHllSketch::getCompositeEstimate() {
+  std::unique_ptr<HllSketch> snapshot(copyAsHllSketch());
+  return snapshot->getCompositeEstimate();
+}
+
+double ConcurrentHllSketch::getLowerBound(const int numStdDev) {
+  std::unique_ptr<HllSketch> snapshot(copyAsHllSketch());
+  return snapshot->getLowerBound(numStdDev);
+}
+
+double ConcurrentHllSketch::getUpperBound(const int numStdDev) {
+  std::unique_ptr<HllSketch> snapshot(copyAsHllSketch());
+  return snapshot->getUpperBound(numStdDev);
+}
+
+int ConcurrentHllSketch::getCompactSerializationBytes() {
+  std::unique_ptr<HllSketch> snapshot(copyAsHllSketch());
+  return snapshot->getCompactSerializationBytes();
+}
+
+int ConcurrentHllSketch::getUpdatableSerializationBytes() {
+  std::unique_ptr<HllSketch> snapshot(copyAsHllSketch());
+  return snapshot->getUpdatableSerializationBytes();
+}
+
+int ConcurrentHllSketch::getLgConfigK() {
+  return lgConfigK;
+}
+
+CurMode ConcurrentHllSketch::getCurMode() {
+  if (registers.load() != nullptr) {
+    return CurMode::HLL;
+  }
+  enter();
+  CouponTable* current = table.load();
+  const CurMode mode = (current == nullptr) ? CurMode::HLL
+      : ((current->lgArrInts == HllUtil::LG_INIT_LIST_SIZE) ? CurMode::LIST : CurMode::SET);
+  leave();
+  return mode;
+}
+
+TgtHllType ConcurrentHllSketch::getTgtHllType() {
+  return TgtHllType::HLL_8;
+}
+
+bool ConcurrentHllSketch::isCompact() {
+  return false;
+}
+
+bool ConcurrentHllSketch::isEmpty() {
+  if (registers.load() != nullptr) {
+    return false;
+  }
+  std::unique_ptr<HllSketch> snapshot(copyAsHllSketch());
+  return snapshot->isEmpty();
+}
+
+// a LIST keeps arrival order, anything else has lost it
+bool ConcurrentHllSketch::isOutOfOrderFlag() {
+  return getCurMode() != CurMode::LIST;
+}
+
+std::ostream& ConcurrentHllSketch::to_string(std::ostream& os, const bool summary,
+                                             const bool detail, const bool auxDetail,
+                                             const bool all) {
+  std::unique_ptr<HllSketch> snapshot(copyAsHllSketch());
+  return snapshot->to_string(os, summary, detail, auxDetail, all);
+}
+
+}
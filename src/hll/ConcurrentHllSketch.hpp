@@ -0,0 +1,98 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#pragma once
+
+#include "BaseHllSketch.hpp"
+#include "HllSketch.hpp"
+
+#include <atomic>
+#include <iostream>
+
+namespace datasketches {
+
+/**
+ * An HLL_8 sketch that any number of threads may update at the same time without locking.
+ *
+ * <p>It goes through the same LIST, SET and HLL modes as HllSketch, at the same coupon
+ * counts. In LIST and SET modes coupons go into an open-addressed table whose slots are
+ * claimed with compare-and-swap. A full table is replaced by a larger one, or by the HLL
+ * registers, without blocking writers: the first thread to find it full installs the
+ * successor, any other thread helps publish it, and the winner copies the old coupons
+ * across while new ones go straight to the successor. Replaced tables are freed once no
+ * thread that might still be reading one is inside the sketch. In HLL mode an update is a
+ * compare-and-swap max on one register byte.
+ *
+ * <p>There is no HIP accumulator, since HIP depends on update order. Estimates and bounds
+ * come from a composite scan of the registers, as for an out-of-order HllSketch, so they
+ * are the same as for an HllSketch that was given the same keys and then unioned.
+ * Reading an estimate takes a snapshot, which costs a pass over the registers.
+ *
+ * <p>reset() and destruction must not run concurrently with anything else.
+ */
+class ConcurrentHllSketch final : public BaseHllSketch {
+  public:
+    explicit ConcurrentHllSketch(const int lgConfigK);
+    explicit ConcurrentHllSketch(const int lgConfigK, const HashType hashType);
+    ConcurrentHllSketch(const ConcurrentHllSketch& that) = delete;
+    ConcurrentHllSketch& operator=(const ConcurrentHllSketch& that) = delete;
+
+    virtual ~ConcurrentHllSketch();
+
+    double getEstimate();
+    double getCompositeEstimate();
+    double getLowerBound(const int numStdDev);
+    double getUpperBound(const int numStdDev);
+
+    int getCompactSerializationBytes();
+    int getUpdatableSerializationBytes();
+    int getLgConfigK();
+
+    CurMode getCurMode();
+    TgtHllType getTgtHllType();
+    bool isCompact();
+    bool isEmpty();
+
+    void reset();
+
+    /**
+     * Returns a new HLL_8 HllSketch holding everything that was added before this call began,
+     * and possibly some concurrent updates. In HLL mode it is marked out of order and its HIP
+     * accumulator is set to the composite estimate. The caller owns the result.
+     */
+    HllSketch* copyAsHllSketch();
+
+    std::ostream& to_string(std::ostream& os, const bool summary,
+                            const bool detail, const bool auxDetail, const bool all);
+
+  protected:
+    virtual void couponUpdate(int coupon);
+    virtual bool isOutOfOrderFlag();
+
+  private:
+    struct CouponTable;
+    struct HllRegisters;
+
+    void init();
+    void freeAll();
+
+    void sparseUpdate(const int coupon);
+    static void hllUpdate(HllRegisters* regs, const int coupon, const int configKmask);
+    void promote(CouponTable* table);
+
+    // Tables are only dereferenced between enter() and leave().
+    void enter();
+    void leave();
+    void retire(CouponTable* table);
+    void reclaim();
+
+    const int lgConfigK;
+    std::atomic<CouponTable*> table; // LIST or SET, null in HLL mode
+    std::atomic<HllRegisters*> registers; // null until HLL mode
+    std::atomic<int> numActive; // threads between enter() and leave()
+    std::atomic<CouponTable*> retired; // replaced tables waiting to be freed
+};
+
+}
@@ -5,45 +5,54 @@
 
 #include "Conversions.hpp"
 #include "HllArray.hpp"
+#include "RegisterScan.hpp"
 
 #include <memory>
 
 namespace datasketches {
 
+// Visits the non-zero registers of either array type without virtual calls.
+template<typename F>
+static void forEachValid(HllArray& hllArr, F&& f) {
+  if (hllArr.getTgtHllType() == TgtHllType::HLL_8) {
+    ((Hll8Array&) hllArr).forEachValid(f);
+  } else {
+    ((Hll4Array&) hllArr).forEachValid(f);
+  }
+}
+
 Hll4Array* Conversions::convertToHll4(HllArray& srcHllArr) {
   const int lgConfigK = srcHllArr.getLgConfigK();
-  Hll4Array* hll4Array = new Hll4Array(lgConfigK);
+  std::pmr::memory_resource* resource = srcHllArr.getResource();
+  Hll4Array* hll4Array = new (resource) Hll4Array(lgConfigK, resource);
   hll4Array->putOutOfOrderFlag(srcHllArr.isOutOfOrderFlag());
 
-  // 1st pass: compute starting curMin and numAtCurMin
-  int pairVals = curMinAndNum(srcHllArr);
-  int curMin = HllUtil::getValue(pairVals);
-  int numAtCurMin = HllUtil::getLow26(pairVals);
+  // 1st pass: compute starting curMin
+  const int curMin = (srcHllArr.getTgtHllType() == TgtHllType::HLL_8)
+      ? RegisterScan::minValue(srcHllArr.hllByteArr, 1 << lgConfigK)
+      : HllUtil::getValue(curMinAndNum(srcHllArr));
 
   // 2nd pass: must know curMin.
-  // Populate KxQ registers, build AuxHashMap if needed
-  std::unique_ptr<PairIterator> itr = srcHllArr.getIterator();
-  // nothing allocated, may be null
-  AuxHashMap* auxHashMap = srcHllArr.getAuxHashMap();
-
-  while (itr->nextValid()) {
-    const int slotNo = itr->getIndex();
-    const int actualValue = itr->getValue();
-    HllArray::hipAndKxQIncrementalUpdate(*hll4Array, 0, actualValue);
+  // Populate the nibbles, build AuxHashMap if needed
+  AuxHashMap* auxHashMap = nullptr; // allocated on the first exception
+
+  forEachValid(srcHllArr, [&](const int slotNo, const int actualValue) {
     if (actualValue >= (curMin + 15)) {
       hll4Array->putSlot(slotNo, HllUtil::AUX_TOKEN);
       if (auxHashMap == nullptr) {
-        auxHashMap = new AuxHashMap(HllUtil::LG_AUX_ARR_INTS[lgConfigK], lgConfigK);
+        auxHashMap = new (resource) AuxHashMap(HllUtil::LG_AUX_ARR_INTS[lgConfigK], lgConfigK,
+                                               resource);
         hll4Array->putAuxHashMap(auxHashMap);
       }
       auxHashMap->mustAdd(slotNo, actualValue);
     } else {
       hll4Array->putSlot(slotNo, actualValue - curMin);
     }
-  }
+  });
 
+  // 3rd pass: KxQ registers and numAtCurMin
   hll4Array->putCurMin(curMin);
-  hll4Array->putNumAtCurMin(numAtCurMin);
+  hll4Array->rebuildKxQ();
   hll4Array->putHipAccum(srcHllArr.getHipAccum());
 
   return hll4Array;
@@ -52,35 +61,36 @@ Hll4Array* Conversions::convertToHll4(HllArray& srcHllArr) {
 int Conversions::curMinAndNum(HllArray& hllArr) {
   int curMin = 64;
   int numAtCurMin = 0;
-  std::unique_ptr<PairIterator> itr = hllArr.getIterator();
-  while (itr->nextAll()) {
-    int v = itr->getValue();
+  int numValid = 0;
+  forEachValid(hllArr, [&](const int /*slotNo*/, const int v) {
+    ++numValid;
     if (v < curMin) {
       curMin = v;
       numAtCurMin = 1;
     } else if (v == curMin) {
       ++numAtCurMin;
     }
-  }
+  });
 
+  // the zeros are not visited, but are the minimum if there are any
+  const int numZeros = (1 << hllArr.getLgConfigK()) - numValid;
+  if (numZeros > 0) {
+    return HllUtil::pair(numZeros, 0);
+  }
   return HllUtil::pair(numAtCurMin, curMin);
 }
 
 Hll8Array* Conversions::convertToHll8(HllArray& srcHllArr) {
   const int lgConfigK = srcHllArr.getLgConfigK();
-  Hll8Array* hll8Array = new Hll8Array(lgConfigK);
+  std::pmr::memory_resource* resource = srcHllArr.getResource();
+  Hll8Array* hll8Array = new (resource) Hll8Array(lgConfigK, resource);
   hll8Array->putOutOfOrderFlag(srcHllArr.isOutOfOrderFlag());
 
-  int numZeros = 1 << lgConfigK;
-  std::unique_ptr<PairIterator> itr = srcHllArr.getIterator();
-  while (itr->nextAll()) {
-    if (itr->getValue() != HllUtil::EMPTY) {
-      --numZeros;
-      hll8Array->couponUpdate(itr->getPair());
-    }
-  }
+  forEachValid(srcHllArr, [hll8Array](const int slotNo, const int value) {
+    hll8Array->putSlot(slotNo, value);
+  });
 
-  hll8Array->putNumAtCurMin(numZeros);
+  hll8Array->rebuildKxQ();
   hll8Array->putHipAccum(srcHllArr.getHipAccum());
   return hll8Array;
 }
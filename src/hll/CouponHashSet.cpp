@@ -9,10 +9,9 @@
 
 namespace datasketches {
 
-static int find(const int* array, const int lgArrInts, const int coupon);
-
-CouponHashSet::CouponHashSet(const int lgConfigK, const TgtHllType tgtHllType)
-  : CouponList(lgConfigK, tgtHllType, CurMode::SET)
+CouponHashSet::CouponHashSet(const int lgConfigK, const TgtHllType tgtHllType,
+                             std::pmr::memory_resource* resource)
+  : CouponList(lgConfigK, tgtHllType, CurMode::SET, resource)
 {
   assert(lgConfigK > 7);
 }
@@ -24,11 +23,11 @@ CouponHashSet::CouponHashSet(const CouponHashSet& that, const TgtHllType tgtHllT
   : CouponList(that, tgtHllType) {}
 
 CouponHashSet* CouponHashSet::copy() {
-  return new CouponHashSet(*this);
+  return new (resource) CouponHashSet(*this);
 }
 
 CouponHashSet* CouponHashSet::copyAs(const TgtHllType tgtHllType) {
-  return new CouponHashSet(*this, tgtHllType);
+  return new (resource) CouponHashSet(*this, tgtHllType);
 }
 
 CouponHashSet::~CouponHashSet() {}
@@ -59,34 +58,35 @@ bool CouponHashSet::checkGrowOrPromote() {
     if (lgCouponArrInts == (lgConfigK - 3)) { // at max size
       return true; // promote to HLL
     }
-    growHashSet(++lgCouponArrInts);
+    growHashSet(lgCouponArrInts + 1);
   }
   return false;
 }
 
 void CouponHashSet::growHashSet(const int tgtLgCoupArrSize) {
   const int tgtLen = 1 << tgtLgCoupArrSize;
-  int* tgtCouponIntArr = new int[tgtLen];
+  int* tgtCouponIntArr = newArray<int>(tgtLen);
   std::fill(tgtCouponIntArr, tgtCouponIntArr + tgtLen, 0);
 
-  for (int i = 0; i < tgtLen; ++i) { // scan existing array for non-zero values
+  const int srcLen = 1 << lgCouponArrInts;
+  for (int i = 0; i < srcLen; ++i) { // scan existing array for non-zero values
     const int fetched = couponIntArr[i];
     if (fetched != HllUtil::EMPTY) {
-      const int idx = find(tgtCouponIntArr, tgtLen, fetched); // search TGT array
+      const int idx = find(tgtCouponIntArr, tgtLgCoupArrSize, fetched); // search TGT array
       if (idx < 0) { // found EMPTY
         tgtCouponIntArr[~idx] = fetched; // insert
         continue;
       }
-      throw new std::runtime_error("Error: Found duplicate coupon");
+      throw std::runtime_error("Error: Found duplicate coupon");
     }
   }
 
-  delete couponIntArr;
+  deleteArray(couponIntArr, srcLen);
   couponIntArr = tgtCouponIntArr;
   lgCouponArrInts = tgtLgCoupArrSize;
 }
 
-static int find(const int* array, const int lgArrInts, const int coupon) {
+int CouponHashSet::find(const int* array, const int lgArrInts, const int coupon) {
   const int arrMask = (1 << lgArrInts) - 1;
   int probe = coupon & arrMask;
   const int loopIndex = probe;
@@ -9,9 +9,18 @@
 
 namespace datasketches {
 
-class CouponHashSet : public CouponList {
+class CouponHashSet final : public CouponList {
+  public:
+    /**
+     * Searches a coupon hash table for an empty entry or the given coupon.
+     * @return the index of the coupon if found, or the one's complement of the
+     * index of the empty entry where it belongs
+     */
+    static int find(const int* array, const int lgArrInts, const int coupon);
+
   protected:
-    explicit CouponHashSet(const int lgConfigK, const TgtHllType tgtHllType);
+    explicit CouponHashSet(const int lgConfigK, const TgtHllType tgtHllType,
+                           std::pmr::memory_resource* resource);
     explicit CouponHashSet(const CouponHashSet& that);
     explicit CouponHashSet(const CouponHashSet& that, const TgtHllType tgtHllType);
 
@@ -21,11 +30,13 @@ class CouponHashSet : public CouponList {
     virtual CouponHashSet* copyAs(const TgtHllType tgtHllType);
 
     virtual HllSketchImpl* couponUpdate(int coupon);
+    using CouponList::couponUpdate;
 
     virtual int getMemDataStart();
     virtual int getPreInts();
 
     friend class CouponList; // so it can access fields declared in CouponList
+    friend class HllSketch; // dispatches to it directly
 
   private:
     bool checkGrowOrPromote();
@@ -15,8 +15,9 @@
 
 namespace datasketches {
 
-CouponList::CouponList(const int lgConfigK, const TgtHllType tgtHllType, const CurMode curMode)
-  : AbstractCoupons(lgConfigK, tgtHllType, curMode) {
+CouponList::CouponList(const int lgConfigK, const TgtHllType tgtHllType, const CurMode curMode,
+                       std::pmr::memory_resource* resource)
+  : AbstractCoupons(lgConfigK, tgtHllType, curMode, resource) {
     if (curMode == CurMode::LIST) {
       lgCouponArrInts = HllUtil::LG_INIT_LIST_SIZE;
       oooFlag = false;
@@ -25,43 +26,43 @@ CouponList::CouponList(const int lgConfigK, const TgtHllType tgtHllType, const C
       oooFlag = true;
     }
     const int arrayLen = 1 << lgCouponArrInts;
-    couponIntArr = new int[arrayLen];
+    couponIntArr = newArray<int>(arrayLen);
     std::fill(couponIntArr, couponIntArr + arrayLen, 0);
     couponCount = 0;
 }
 
 CouponList::CouponList(const CouponList& that)
-  : AbstractCoupons(that.lgConfigK, that.tgtHllType, that.curMode),
+  : AbstractCoupons(that.lgConfigK, that.tgtHllType, that.curMode, that.resource),
     lgCouponArrInts(that.lgCouponArrInts),
     couponCount(that.couponCount),
     oooFlag(that.oooFlag) {
 
   const int numItems = 1 << lgCouponArrInts;
-  couponIntArr = new int[numItems];
+  couponIntArr = newArray<int>(numItems);
   std::copy(that.couponIntArr, that.couponIntArr + numItems, couponIntArr);
 }
 
 CouponList::CouponList(const CouponList& that, const TgtHllType tgtHllType)
-  : AbstractCoupons(that.lgConfigK, tgtHllType, that.curMode),
+  : AbstractCoupons(that.lgConfigK, tgtHllType, that.curMode, that.resource),
     lgCouponArrInts(that.lgCouponArrInts),
     couponCount(that.couponCount),
     oooFlag(that.oooFlag) {
 
   const int numItems = 1 << lgCouponArrInts;
-  couponIntArr = new int[numItems];
+  couponIntArr = newArray<int>(numItems);
   std::copy(that.couponIntArr, that.couponIntArr + numItems, couponIntArr);
 }
 
 CouponList::~CouponList() {
-  delete couponIntArr;
+  deleteArray(couponIntArr, 1 << lgCouponArrInts);
 }
 
 CouponList* CouponList::copy() {
-  return new CouponList(*this);
+  return new (resource) CouponList(*this);
 }
 
 CouponList* CouponList::copyAs(const TgtHllType tgtHllType) {
-  return new CouponList(*this, tgtHllType);
+  return new (resource) CouponList(*this, tgtHllType);
 }
 
 HllSketchImpl* CouponList::couponUpdate(int coupon) {
@@ -113,7 +114,7 @@ void CouponList::putOutOfOrderFlag(bool oooFlag) {
 }
 
 CouponList* CouponList::reset() {
-  return new CouponList(lgConfigK, tgtHllType, CurMode::LIST);
+  return new (resource) CouponList(lgConfigK, tgtHllType, CurMode::LIST, resource);
 }
 
 int CouponList::getLgCouponArrInts() {
@@ -132,7 +133,8 @@ std::unique_ptr<PairIterator> CouponList::getIterator() {
 HllSketchImpl* CouponList::promoteHeapListToSet(CouponList& list) {
   const int couponCount = list.couponCount;
   const int* arr = list.couponIntArr;
-  CouponHashSet* chSet = new CouponHashSet(list.lgConfigK, list.tgtHllType);
+  CouponHashSet* chSet = new (list.resource) CouponHashSet(list.lgConfigK, list.tgtHllType,
+                                                          list.resource);
   for (int i = 0; i < couponCount; ++i) {
     chSet->couponUpdate(arr[i]);
   }
@@ -142,13 +144,13 @@ HllSketchImpl* CouponList::promoteHeapListToSet(CouponList& list) {
 }
 
 HllSketchImpl* CouponList::promoteHeapListOrSetToHll(CouponList& src) {
-  HllArray* tgtHllArr = HllArray::newHll(src.lgConfigK, src.tgtHllType);
-  std::unique_ptr<PairIterator> srcItr = src.getIterator();
+  HllArray* tgtHllArr = HllArray::newHll(src.lgConfigK, src.tgtHllType, src.resource);
   tgtHllArr->putKxQ0(1 << src.lgConfigK);
-  while (srcItr->nextValid()) {
-    tgtHllArr->couponUpdate(srcItr->getPair());
-    tgtHllArr->putHipAccum(src.getEstimate());
-  }
+  src.forEachCoupon([tgtHllArr](const int coupon) {
+    tgtHllArr->couponUpdate(coupon);
+  });
+  // the HIP updates above are superseded by the exact count held in the source
+  tgtHllArr->putHipAccum(src.getEstimate());
   tgtHllArr->putOutOfOrderFlag(false);
   return tgtHllArr;
 }
@@ -11,7 +11,8 @@ namespace datasketches {
 
 class CouponList : public AbstractCoupons {
   public:
-    explicit CouponList(const int lgConfigK, const TgtHllType tgtHllType, const CurMode curMode);
+    explicit CouponList(const int lgConfigK, const TgtHllType tgtHllType, const CurMode curMode,
+                        std::pmr::memory_resource* resource);
     explicit CouponList(const CouponList& that);
     explicit CouponList(const CouponList& that, const TgtHllType tgtHllType);
 
@@ -21,10 +22,17 @@ class CouponList : public AbstractCoupons {
     virtual CouponList* copyAs(const TgtHllType tgtHllType);
 
     virtual HllSketchImpl* couponUpdate(int coupon);
+    using HllSketchImpl::couponUpdate;
 
     HllSketchImpl* promoteHeapListToSet(CouponList& list);
     HllSketchImpl* promoteHeapListOrSetToHll(CouponList& src);
 
+    /**
+     * Calls f(coupon) for every coupon held, in array order. Unlike getIterator() this
+     * allocates nothing and makes no virtual calls. f must not modify this list.
+     */
+    template<typename F> void forEachCoupon(F&& f);
+
 
   protected:
     virtual int getCouponCount();
@@ -45,6 +53,19 @@ class CouponList : public AbstractCoupons {
     int couponCount;
     bool oooFlag;
     int* couponIntArr;
+
+    friend class HllSketch; // reads the coupon count directly
 };
 
+template<typename F>
+void CouponList::forEachCoupon(F&& f) {
+  const int len = 1 << lgCouponArrInts;
+  for (int i = 0; i < len; ++i) {
+    const int coupon = couponIntArr[i];
+    if (coupon != HllUtil::EMPTY) {
+      f(coupon);
+    }
+  }
+}
+
 }
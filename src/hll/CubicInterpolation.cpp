@@ -9,18 +9,17 @@
 
 namespace datasketches {
 
-static double interpolateUsingXAndYTables(double xArr[], double yArr[], int offset, double x);
+static double interpolateUsingXAndYTables(const double xArr[], const double yArr[], int offset, double x);
 static double cubicInterpolate(double x0, double y0, double x1, double y1,
                                double x2, double y2, double x3, double y3, double x);
 static int findStraddle(const double xArr[], const int len, const double x);
-static int recursiveFindStraddle(const double xArr[], const int l, const int r, const double x);
 static double interpolateUsingXArrAndYStride(const double xArr[], const double yStride,
                                              const int offset, const double x);
 
-const int numEntries = 40;
+static constexpr int numEntries = 40;
 
 //Computed for Coupon lgK = 26 ONLY. Designed for the cubic interpolator function.
-double xArr[numEntries] = {
+static constexpr double xArr[numEntries] = {
     0.0, 1.0, 20.0, 400.0,
     8000.0, 160000.0, 300000.0, 600000.0,
     900000.0, 1200000.0, 1500000.0, 1800000.0,
@@ -34,7 +33,7 @@ double xArr[numEntries] = {
 };
 
 //Computed for Coupon lgK = 26 ONLY. Designed for the cubic interpolator function.
-double yArr[numEntries] =  {
+static constexpr double yArr[numEntries] =  {
     0.0000000000000000, 1.0000000000000000, 20.0000009437402611, 400.0003963713384110,
     8000.1589294602090376, 160063.6067763759638183, 300223.7071597663452849, 600895.5933856170158833,
     902016.8065120954997838, 1203588.4983199508860707, 1505611.8245524743106216, 1808087.9449319066479802,
@@ -47,6 +46,9 @@ double yArr[numEntries] =  {
     9520624.7036988288164139, 9835293.9703129194676876, 10150448.9097250290215015, 10466090.8000503256917000
 };
 
+// one bucket per 300000 step above 160000; the first bucket holds the five smaller entries
+static constexpr StraddleIndex<numEntries, 64> xArrIndex(xArr);
+
 
 /**
  * Cubic interpolation using interpolation X and Y tables.
@@ -91,7 +93,7 @@ double CubicInterpolation::usingXAndYTables(double x) {
     return (yArr[numEntries-1]);
   }
 
-  offset = findStraddle (xArr, numEntries, x);
+  offset = xArrIndex.find(x);
   assert (offset >= 0 && offset <= numEntries-2);
 
   if (offset == 0) { // corner case
@@ -107,7 +109,7 @@ double CubicInterpolation::usingXAndYTables(double x) {
 }
 
 // In C: again-two-registers cubic_interpolate_aux L1368
-static double interpolateUsingXAndYTables(double xArr[], double yArr[], int offset, double x) {
+static double interpolateUsingXAndYTables(const double xArr[], const double yArr[], int offset, double x) {
     return (cubicInterpolate(xArr[offset+0], yArr[offset+0],
                         xArr[offset+1], yArr[offset+1],
                         xArr[offset+2], yArr[offset+2],
@@ -139,21 +141,15 @@ static inline double cubicInterpolate(double x0, double y0, double x1, double y1
 /* returns j such that xArr[j] <= x and x < xArr[j+1] */
 static int findStraddle(const double xArr[], const int len, const double x)
 {
-  assert(len >= 2 && x >= xArr[0] && x <= xArr[len-1]);
-  return(recursiveFindStraddle(xArr, 0, len-1, x));
-}
-
-
-/* the invariant here is that xArr[l] <= x && x < xArr[r] */
-static int recursiveFindStraddle(const double xArr[], const int l, const int r, const double x)
-{
-  int m;
-  assert(l < r);
-  assert(xArr[l] <= x && x < xArr[r]); /* the invariant */
-  if (l+1 == r) return (l);
-  m = l + ((r-l)/2);
-  if (xArr[m] <= x) return (recursiveFindStraddle(xArr, m, r, x));
-  else              return (recursiveFindStraddle(xArr, l, m, x));
+  assert(len >= 2 && x >= xArr[0] && x < xArr[len-1]);
+  int l = 0;
+  int r = len - 1;
+  while (l + 1 < r) { /* the invariant here is that xArr[l] <= x && x < xArr[r] */
+    const int m = l + ((r-l)/2);
+    if (xArr[m] <= x) { l = m; }
+    else              { r = m; }
+  }
+  return (l);
 }
 
 
@@ -179,10 +175,21 @@ double CubicInterpolation::usingXArrAndYStride(const double xArr[], const int xA
     return (yStride * (xArrLenM1));
   }
 
-  const int offset = findStraddle(xArr, xArrLen, x); //uses recursion
+  return usingXArrAndYStride(xArr, xArrLen, yStride, x, findStraddle(xArr, xArrLen, x));
+}
+
+double CubicInterpolation::usingXArrAndYStride(const double xArr[], const int xArrLen,
+                                               const double yStride, const double x,
+                                               const int offset) {
+  const int xArrLenM1 = xArrLen - 1;
   const int xArrLenM2 = xArrLen - 2;
+  assert ((xArrLen >= 4) && (x >= xArr[0]) && (x <= xArr[xArrLenM1]));
   assert ((offset >= 0) && (offset <= (xArrLenM2)));
 
+  if (x ==  xArr[xArrLenM1]) { /* corner case */
+    return (yStride * (xArrLenM1));
+  }
+
   if (offset == 0) { /* corner case */
     return (interpolateUsingXArrAndYStride(xArr, yStride, (offset - 0), x));
   }
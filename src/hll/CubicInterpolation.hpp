@@ -5,8 +5,56 @@
 
 #pragma once
 
+#include <cassert>
+#include <cstdint>
+
 namespace datasketches {
 
+/**
+ * Finds the interval of a sorted table that holds x in constant time. The range of the
+ * table is cut into NumBuckets equal buckets, and each bucket records the last entry below
+ * it, from which a lookup steps forward; with about one entry per bucket that is at most
+ * a step or two. Built at compile time from a constexpr table.
+ */
+template<int Len, int NumBuckets>
+class StraddleIndex {
+  public:
+    constexpr explicit StraddleIndex(const double (&xArr)[Len])
+      : xArr(xArr),
+        x0(xArr[0]),
+        invWidth(NumBuckets / (xArr[Len - 1] - xArr[0])),
+        first() {
+      int i = 0;
+      for (int b = 0; b < NumBuckets; ++b) {
+        // every entry before the bucket is below any x that lands in it
+        while ((i + 1 < Len) && (bucketOf(xArr[i + 1]) < b)) { ++i; }
+        first[b] = (uint16_t) i;
+      }
+    }
+
+    /**
+     * @param x at least the first entry and below the last
+     * @return the i with xArr[i] <= x < xArr[i + 1]
+     */
+    int find(const double x) const {
+      assert((x >= xArr[0]) && (x < xArr[Len - 1]));
+      const int b = bucketOf(x);
+      int i = first[(b < NumBuckets) ? b : NumBuckets - 1];
+      while (xArr[i + 1] <= x) { ++i; }
+      return i;
+    }
+
+  private:
+    constexpr int bucketOf(const double x) const {
+      return (int) ((x - x0) * invWidth);
+    }
+
+    const double* xArr;
+    double x0;
+    double invWidth;
+    uint16_t first[NumBuckets];
+};
+
 class CubicInterpolation {
   public:
     static double usingXAndYTables(const double xArr[], const double yArr[],
@@ -16,6 +64,10 @@ class CubicInterpolation {
 
     static double usingXArrAndYStride(const double xArr[], const int xArrLen,
                                const double yStride, const double x);
+
+    // Same, for a caller that has already found the i with xArr[i] <= x < xArr[i + 1].
+    static double usingXArrAndYStride(const double xArr[], const int xArrLen,
+                               const double yStride, const double x, const int straddle);
 };
 
 }
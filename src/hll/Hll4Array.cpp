@@ -4,12 +4,29 @@
  */
 
 #include "Hll4Array.hpp"
+#include "RegisterScan.hpp"
 
+#include <algorithm>
 #include <cstring>
 #include <memory>
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 namespace datasketches {
 
+// Like Java's Long.bitCount()
+static inline int bitCount(const uint64_t x) {
+#if defined(_MSC_VER) && defined(_M_X64)
+  return (int) __popcnt64(x);
+#elif defined(_MSC_VER)
+  return (int) (__popcnt((unsigned) x) + __popcnt((unsigned) (x >> 32)));
+#else
+  return __builtin_popcountll(x);
+#endif
+}
+
 Hll4Iterator::Hll4Iterator(Hll4Array& hllArray, const int lengthPairs)
   : HllPairIterator(lengthPairs),
     hllArray(hllArray)
@@ -27,23 +44,42 @@ int Hll4Iterator::value() {
   }
 }
 
-Hll4Array::Hll4Array(const int lgConfigK) :
-    HllArray(lgConfigK, TgtHllType::HLL_4) {
+Hll4Array::Hll4Array(const int lgConfigK, std::pmr::memory_resource* resource) :
+    HllArray(lgConfigK, TgtHllType::HLL_4, resource),
+    auxHashMap(nullptr),
+    blockCurMin(nullptr),
+    lgSlotsPerBlock(0),
+    numBlocks(0),
+    sweepCursor(0),
+    unsettled(false) {
   const int numBytes = hll4ArrBytes(lgConfigK);
-  hllByteArr = new uint8_t[numBytes];
+  hllByteArr = newArray<uint8_t>(numBytes);
   std::fill(hllByteArr, hllByteArr + numBytes, 0);
-  auxHashMap = nullptr;
+}
+
+// the registers must be settled before the base class copies them
+static Hll4Array& settled(Hll4Array& array) {
+  array.settle();
+  return array;
 }
 
 Hll4Array::Hll4Array(Hll4Array& that) :
-  HllArray(that)
+  HllArray(settled(that)),
+  auxHashMap(nullptr),
+  blockCurMin(nullptr),
+  lgSlotsPerBlock(that.lgSlotsPerBlock),
+  numBlocks(that.numBlocks),
+  sweepCursor(that.sweepCursor),
+  unsettled(false)
 {
   // can determine hllByteArr size in parent class, no need to allocate here
   // but parent class doesn't handle the auxHashMap
   if (that.auxHashMap != nullptr) {
     auxHashMap = that.auxHashMap->copy();
-  } else {
-    auxHashMap = nullptr;
+  }
+  if (that.blockCurMin != nullptr) {
+    blockCurMin = newArray<uint8_t>(numBlocks);
+    std::copy(that.blockCurMin, that.blockCurMin + numBlocks, blockCurMin);
   }
 }
 
@@ -52,18 +88,21 @@ Hll4Array::~Hll4Array() {
   if (auxHashMap != nullptr) {
     delete auxHashMap;
   }
+  deleteArray(blockCurMin, numBlocks);
 }
 
 Hll4Array* Hll4Array::copy() {
-  return new Hll4Array(*this);
+  return new (resource) Hll4Array(*this);
 }
 
 std::unique_ptr<PairIterator> Hll4Array::getIterator() {
+  settle();
   PairIterator* itr = new Hll4Iterator(*this, 1 << lgConfigK);
   return std::unique_ptr<PairIterator>(itr);
 }
 
 std::unique_ptr<PairIterator> Hll4Array::getAuxIterator() {
+  settle();
   if (auxHashMap != nullptr) {
     return auxHashMap->getIterator();
   }
@@ -74,7 +113,58 @@ int Hll4Array::getHllByteArrBytes() {
   return hll4ArrBytes(lgConfigK);
 }
 
+// Unpacks the nibbles a chunk at a time into actual values for RegisterScan, with AUX_TOKEN
+// slots mapped to a value the scan skips. Exceptions are then added from the AuxHashMap;
+// they are never at curMin.
+void Hll4Array::rebuildKxQ() {
+  settle();
+  if (valueHistogram != nullptr) {
+    std::fill(valueHistogram, valueHistogram + HllUtil::VAL_MASK_6 + 1, 0);
+    countValues(valueHistogram);
+    putKxQFromValueHistogram();
+    return;
+  }
+  const int numBytes = hll4ArrBytes(lgConfigK);
+  const int chunkBytes = (numBytes < REBUILD_CHUNK_BYTES) ? numBytes : REBUILD_CHUNK_BYTES;
+  uint8_t values[2 * REBUILD_CHUNK_BYTES];
+  uint8_t nibToValue[HllUtil::AUX_TOKEN + 1];
+  for (int nib = 0; nib < HllUtil::AUX_TOKEN; ++nib) {
+    nibToValue[nib] = (uint8_t) (nib + curMin);
+  }
+  nibToValue[HllUtil::AUX_TOKEN] = 0xff;
+
+  double sum0 = 0.0;
+  double sum1 = 0.0;
+  int numAtMin = 0;
+  for (int start = 0; start < numBytes; start += chunkBytes) {
+    for (int i = 0; i < chunkBytes; ++i) {
+      const int theByte = hllByteArr[start + i];
+      values[2 * i] = nibToValue[theByte & HllUtil::loNibbleMask];
+      values[2 * i + 1] = nibToValue[theByte >> 4];
+    }
+    double chunk0, chunk1;
+    int chunkAtMin;
+    RegisterScan::sumInvPow2(values, 2 * chunkBytes, curMin, chunk0, chunk1, chunkAtMin);
+    sum0 += chunk0; // exact, see RegisterScan
+    sum1 += chunk1;
+    numAtMin += chunkAtMin;
+  }
+
+  if (auxHashMap != nullptr) {
+    auxHashMap->forEachEntry([&sum0, &sum1](const int /*key*/, const int actualValue) {
+      if (actualValue < 32) { sum0 += HllUtil::invPow2(actualValue); }
+      else                  { sum1 += HllUtil::invPow2(actualValue); }
+    });
+  }
+
+  kxq0 = sum0;
+  kxq1 = sum1;
+  numAtCurMin = numAtMin;
+  invalidateEstimates();
+}
+
 AuxHashMap* Hll4Array::getAuxHashMap() {
+  settle();
   return auxHashMap;
 }
 
@@ -91,6 +181,9 @@ int Hll4Array::getSlot(const int slotNo) {
 }
 
 HllSketchImpl* Hll4Array::couponUpdate(const int coupon) {
+  if (sweepCursor < numBlocks) {
+    rebaseBlock(sweepCursor++); // bounded share of a pending incremental shift
+  }
   const int newValue = HllUtil::getValue(coupon);
   if (newValue <= curMin) {
     return this; // quick rejectio, but only works for large N
@@ -101,6 +194,14 @@ HllSketchImpl* Hll4Array::couponUpdate(const int coupon) {
   return this;
 }
 
+HllSketchImpl* Hll4Array::couponUpdate(const int coupons[], const int len, int& numApplied) {
+  for (int i = 0; i < len; ++i) {
+    Hll4Array::couponUpdate(coupons[i]);
+  }
+  numApplied = len;
+  return this;
+}
+
 void Hll4Array::putSlot(const int slotNo, const int newValue) {
   const int byteno = slotNo >> 1;
   const int oldValue = hllByteArr[byteno];
@@ -118,9 +219,13 @@ void Hll4Array::internalHll4Update(const int slotNo, const int newVal) {
   assert((0 <= slotNo) && (slotNo < (1 << lgConfigK)));
   assert(newVal > 0);
 
+  // with incremental shifting the nibble may be relative to an older curMin
+  const int base = (blockCurMin == nullptr) ? curMin : blockCurMin[slotNo >> lgSlotsPerBlock];
   const int rawStoredOldValue = getSlot(slotNo); // could be a 0
-  // this is provably a LB:
-  const int lbOnOldValue = rawStoredOldValue + curMin; // lower bound, could be 0
+  // this is provably a LB, except for an unsettled exception, which may have been
+  // added relative to an older curMin:
+  const int lbOnOldValue = ((rawStoredOldValue == HllUtil::AUX_TOKEN) && unsettled)
+      ? base : rawStoredOldValue + base; // lower bound, could be 0
 
   if (newVal > lbOnOldValue) { // 842
     // Note: if an AUX_TOKEN exists, then auxHashMap must alraedy exist
@@ -136,14 +241,14 @@ void Hll4Array::internalHll4Update(const int slotNo, const int newVal) {
 
       // newVal >= curMin
 
-      const int shiftedNewValue = newVal - curMin; // 874
+      const int shiftedNewValue = newVal - base; // 874
       assert(shiftedNewValue >= 0);
 
       if (rawStoredOldValue == HllUtil::AUX_TOKEN) { // 879
         // Given that we have an AUX_TOKEN, tehre are 4 cases for how to
         // actually modify the data structure
 
-        if (shiftedNewValue >= HllUtil::AUX_TOKEN) { // case 1: 881
+        if ((shiftedNewValue >= HllUtil::AUX_TOKEN) || unsettled) { // case 1: 881
           // the byte array already contains aux token
           // This is the case where old and new values are both exceptions.
           // The 4-bit array already is AUX_TOKEN, only need to update auxHashMap
@@ -151,7 +256,8 @@ void Hll4Array::internalHll4Update(const int slotNo, const int newVal) {
         }
         else { // case 2: 885
           // This is the hypothetical case where the old value is an exception and the new one is not,
-          // which is impossible given that curMin has not changed here and newVal > oldValue
+          // which is impossible given that curMin has not changed here and newVal > oldValue.
+          // With incremental shifting an unsettled exception may now fit, but stays one.
           throw std::runtime_error("Impossible case");
         }
       }
@@ -162,7 +268,8 @@ void Hll4Array::internalHll4Update(const int slotNo, const int newVal) {
           // added to the exception table
           putSlot(slotNo, HllUtil::AUX_TOKEN);
           if (auxHashMap == nullptr) {
-            auxHashMap = new AuxHashMap(HllUtil::LG_AUX_ARR_INTS[lgConfigK], lgConfigK);
+            auxHashMap = new (resource) AuxHashMap(HllUtil::LG_AUX_ARR_INTS[lgConfigK],
+                                                   lgConfigK, resource);
           }
           auxHashMap->mustAdd(slotNo, newVal);
         }
@@ -177,6 +284,15 @@ void Hll4Array::internalHll4Update(const int slotNo, const int newVal) {
       if (actualOldValue == curMin) { // 908
         assert(numAtCurMin >= 1);
         decNumAtCurMin();
+        if (blockCurMin != nullptr) {
+          // the blocks catch up over the following updates
+          while (numAtCurMin == 0) {
+            ++curMin;
+            numAtCurMin = valueHistogram[curMin];
+            sweepCursor = 0;
+            unsettled = true;
+          }
+        }
         while (numAtCurMin == 0) {
           shiftToBiggerCurMin(); // increases curMin by 1, builds a new aux table
           // shifts values in 4-bit table and recounts curMin
@@ -197,41 +313,19 @@ void Hll4Array::shiftToBiggerCurMin() {
   const int configK = 1 << lgConfigK;
   const int configKmask = configK - 1;
 
-  int numAtNewCurMin = 0;
+  // Decrement the stored values by one unless they equal AUX_TOKEN, where they are left
+  // alone but counted to be checked later. A stored value of 0 is an error.
   int numAuxTokens = 0;
-
-  // Walk through the slots of 4-bit array decrementing stored values by one unless it
-  // equals AUX_TOKEN, where it is left alone but counted to be checked later.
-  // If oldStoredValue is 0 it is an error.
-  // If the decremented value is 0, we increment numAtNewCurMin.
-  // Because getNibble is masked to 4 bits oldStoredValue can never be > 15 or negative
-  for (int i = 0; i < configK; i++) { //724
-    int oldStoredValue = getSlot(i);
-    if (oldStoredValue == 0) {
-      throw std::runtime_error("Array slots cannot be 0 at this point.");
-    }
-    if (oldStoredValue < HllUtil::AUX_TOKEN) {
-      putSlot(i, --oldStoredValue);
-      if (oldStoredValue == 0) { numAtNewCurMin++; }
-    } else { //oldStoredValue == AUX_TOKEN
-      numAuxTokens++;
-      assert(auxHashMap != nullptr); // auxHashMap cannot be null at this point
-    }
-  }
+  const int numAtNewCurMin = decrementNibbles(hllByteArr, hll4ArrBytes(lgConfigK), numAuxTokens);
+  assert((numAuxTokens == 0) || (auxHashMap != nullptr));
 
   // If old AuxHashMap exists, walk through it updating some slots and build a new AuxHashMap
   // if needed.
   AuxHashMap* newAuxMap = nullptr;
   if (auxHashMap != nullptr) {
-    int slotNum;
-    int oldActualVal;
-    int newShiftedVal;
-
-    std::unique_ptr<PairIterator> itr = auxHashMap->getIterator();
-    while (itr->nextValid()) {
-      slotNum = itr->getKey() & configKmask;
-      oldActualVal = itr->getValue();
-      newShiftedVal = oldActualVal - newCurMin;
+    auxHashMap->forEachEntry([&](const int key, const int oldActualVal) {
+      const int slotNum = key & configKmask;
+      const int newShiftedVal = oldActualVal - newCurMin;
       assert(newShiftedVal >= 0);
 
       assert(getSlot(slotNum) == HllUtil::AUX_TOKEN);
@@ -246,11 +340,12 @@ void Hll4Array::shiftToBiggerCurMin() {
       else { //newShiftedVal >= AUX_TOKEN
         // the former exception remains an exception, so must be added to the newAuxMap
         if (newAuxMap == nullptr) {
-          newAuxMap = new AuxHashMap(HllUtil::LG_AUX_ARR_INTS[lgConfigK], lgConfigK);
+          newAuxMap = new (resource) AuxHashMap(HllUtil::LG_AUX_ARR_INTS[lgConfigK],
+                                                lgConfigK, resource);
         }
         newAuxMap->mustAdd(slotNum, oldActualVal);
       }
-    } //end scan of oldAuxMap
+    }); //end scan of oldAuxMap
   } //end if (auxHashMap != null)
   else { // oldAuxMap == null
     assert(numAuxTokens == 0);
@@ -274,4 +369,108 @@ void Hll4Array::shiftToBiggerCurMin() {
   numAtCurMin = numAtNewCurMin;
 }
 
-}
\ No newline at end of file
+// SWAR version of the per-slot loop in shiftToBiggerCurMin(): a 64-bit word holds 16
+// nibbles, and since no nibble is 0 the per-nibble subtraction never borrows across nibbles.
+// Byte order within a word does not matter because every nibble is treated alike.
+int Hll4Array::decrementNibbles(uint8_t* hllByteArr, const int numBytes, int& numAuxTokens) {
+  const uint64_t lowBits = 0x1111111111111111ULL; // bit 0 of every nibble
+  int numZeros = 0;
+  int numAux = 0;
+  for (int i = 0; i < numBytes; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, hllByteArr + i, sizeof(word));
+    // bit 0 of a nibble is set if any bit of it is, or if all bits of it are
+    const uint64_t anyBits = (word | (word >> 1) | (word >> 2) | (word >> 3)) & lowBits;
+    const uint64_t allBits = word & (word >> 1) & (word >> 2) & (word >> 3) & lowBits;
+    if (anyBits != lowBits) {
+      throw std::runtime_error("Array slots cannot be 0 at this point.");
+    }
+    word -= lowBits & ~allBits; // AUX_TOKEN is all bits set
+    const uint64_t nonZero = (word | (word >> 1) | (word >> 2) | (word >> 3)) & lowBits;
+    std::memcpy(hllByteArr + i, &word, sizeof(word));
+    numZeros += 16 - bitCount(nonZero);
+    numAux += bitCount(allBits);
+  }
+  numAuxTokens = numAux;
+  return numZeros;
+}
+
+void Hll4Array::putIncrementalShift(const bool flag) {
+  if (flag == isIncrementalShift()) { return; }
+  if (!flag) {
+    settle();
+    deleteArray(blockCurMin, numBlocks);
+    blockCurMin = nullptr;
+    lgSlotsPerBlock = 0;
+    numBlocks = 0;
+    sweepCursor = 0;
+    return;
+  }
+
+  const int configK = 1 << lgConfigK;
+  HllArray::putValueHistogram(true);
+  lgSlotsPerBlock = (lgConfigK < LG_MAX_SLOTS_PER_BLOCK) ? lgConfigK : LG_MAX_SLOTS_PER_BLOCK;
+  numBlocks = configK >> lgSlotsPerBlock;
+  blockCurMin = newArray<uint8_t>(numBlocks);
+  std::fill(blockCurMin, blockCurMin + numBlocks, (uint8_t) curMin);
+  sweepCursor = numBlocks;
+  unsettled = false;
+}
+
+bool Hll4Array::isIncrementalShift() {
+  return blockCurMin != nullptr;
+}
+
+void Hll4Array::putValueHistogram(const bool flag) {
+  HllArray::putValueHistogram(flag || isIncrementalShift());
+}
+
+// Brings one block's nibbles from its own curMin to the current one. Every actual value is
+// at least curMin, so no stored nibble is smaller than the difference.
+void Hll4Array::rebaseBlock(const int blockNo) {
+  const int delta = curMin - blockCurMin[blockNo];
+  if (delta == 0) { return; }
+  const uint64_t lowBits = 0x1111111111111111ULL; // bit 0 of every nibble
+  const int bytesPerBlock = 1 << (lgSlotsPerBlock - 1);
+  uint8_t* block = hllByteArr + (blockNo * bytesPerBlock);
+  for (int i = 0; i < bytesPerBlock; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, block + i, sizeof(word));
+    const uint64_t auxTokens = word & (word >> 1) & (word >> 2) & (word >> 3) & lowBits;
+    word -= (lowBits & ~auxTokens) * delta; // delta < 16, so no carries between nibbles
+    std::memcpy(block + i, &word, sizeof(word));
+  }
+  blockCurMin[blockNo] = (uint8_t) curMin;
+}
+
+// Rebases the remaining blocks and moves exceptions that now fit back into the nibbles,
+// as the AuxHashMap rebuild in shiftToBiggerCurMin() does.
+void Hll4Array::settle() {
+  if (!unsettled) { return; }
+  for (int i = 0; i < numBlocks; ++i) {
+    rebaseBlock(i);
+  }
+  sweepCursor = numBlocks;
+
+  if (auxHashMap != nullptr) {
+    const int configKmask = (1 << lgConfigK) - 1;
+    AuxHashMap* newAuxMap = nullptr;
+    auxHashMap->forEachEntry([&](const int key, const int actualVal) {
+      const int slotNum = key & configKmask;
+      if (actualVal - curMin < HllUtil::AUX_TOKEN) {
+        putSlot(slotNum, actualVal - curMin);
+      } else {
+        if (newAuxMap == nullptr) {
+          newAuxMap = new (resource) AuxHashMap(HllUtil::LG_AUX_ARR_INTS[lgConfigK],
+                                                lgConfigK, resource);
+        }
+        newAuxMap->mustAdd(slotNum, actualVal);
+      }
+    });
+    delete auxHashMap;
+    auxHashMap = newAuxMap;
+  }
+  unsettled = false;
+}
+
+}
@@ -11,9 +11,9 @@
 
 namespace datasketches {
 
-class Hll4Array : public HllArray {
+class Hll4Array final : public HllArray {
   public:
-    explicit Hll4Array(const int lgConfigK);
+    explicit Hll4Array(const int lgConfigK, std::pmr::memory_resource* resource);
     explicit Hll4Array(Hll4Array& that);
 
     virtual ~Hll4Array();
@@ -23,26 +23,101 @@ class Hll4Array : public HllArray {
     virtual std::unique_ptr<PairIterator> getIterator();
     virtual std::unique_ptr<PairIterator> getAuxIterator();
 
+    /**
+     * Calls f(slotNo, value) for every non-zero register, in slot order, with exceptions
+     * resolved through the AuxHashMap. Settles first, like getIterator(), but allocates
+     * nothing and makes no virtual calls.
+     */
+    template<typename F> void forEachValid(F&& f);
+
     virtual int getSlot(const int slotNo);
     virtual void putSlot(const int slotNo, const int value);
 
+    virtual void rebuildKxQ();
+
+    // stays enabled while incremental shifting needs it
+    virtual void putValueHistogram(const bool flag);
+
     virtual int getHllByteArrBytes();
 
     virtual HllSketchImpl* couponUpdate(const int coupon);
+    virtual HllSketchImpl* couponUpdate(const int coupons[], const int len, int& numApplied);
 
     virtual AuxHashMap* getAuxHashMap();
     // does *not* delete old map if overwriting
     void putAuxHashMap(AuxHashMap* auxHashMap);
 
+    /**
+     * Decrements every packed 4-bit value in the array except AUX_TOKEN, as needed when
+     * curMin increases. Works on 16 nibbles at a time.
+     * @param hllByteArr the packed nibbles, two per byte
+     * @param numBytes the length of hllByteArr, a multiple of 8
+     * @param numAuxTokens set to the number of AUX_TOKEN nibbles, which are left unchanged
+     * @return the number of nibbles that are zero after the shift
+     * @throws std::runtime_error if any nibble is already zero
+     */
+    static int decrementNibbles(uint8_t* hllByteArr, const int numBytes, int& numAuxTokens);
+
+    /**
+     * Enables or disables incremental curMin shifting. Normally raising curMin rewrites all
+     * K registers inside the update that triggered it. When enabled, a histogram of register
+     * values makes finding the new curMin O(1), and each block of registers keeps the curMin
+     * its nibbles are relative to. Later updates sweep one block each to the current curMin,
+     * which bounds the work done by any single update. Estimates are unaffected.
+     *
+     * <p>Reads of the registers (iterators, the AuxHashMap, copies) first call settle().
+     * Unions instead read each block relative to its own curMin, leaving the source as is.
+     * Enabling costs one pass over the registers, to enable the value histogram, which
+     * disabling leaves on.
+     * @param flag true to enable, false to settle and go back to eager shifting
+     */
+    void putIncrementalShift(const bool flag);
+    bool isIncrementalShift();
+
+    /**
+     * Finishes any pending incremental shift, leaving the registers and AuxHashMap exactly as
+     * eager shifting would have. Does nothing if incremental shifting is disabled.
+     */
+    void settle();
+
   protected:
     void internalHll4Update(const int slotNo, const int newVal);
     void shiftToBiggerCurMin();
+    void rebaseBlock(const int blockNo);
 
     AuxHashMap* auxHashMap;
 
+    // incremental curMin shifting, all null or zero when disabled
+    uint8_t* blockCurMin; // for each block, the curMin its nibbles are relative to
+    int lgSlotsPerBlock;
+    int numBlocks;
+    int sweepCursor; // next block to rebase, numBlocks when none are behind curMin
+    bool unsettled; // true if some block or AuxHashMap entry predates the latest curMin
+
+  private:
+    // blocks of 128 slots are 64 bytes, one cache line
+    static const int LG_MAX_SLOTS_PER_BLOCK = 7;
+    // packed bytes unpacked per RegisterScan call in rebuildKxQ()
+    static const int REBUILD_CHUNK_BYTES = 512;
+
     friend class Hll4Iterator;
+    friend class HllUnion;
 };
 
+template<typename F>
+void Hll4Array::forEachValid(F&& f) {
+  settle();
+  const int numSlots = 1 << lgConfigK;
+  for (int slotNo = 0; slotNo < numSlots; ++slotNo) {
+    const int nib = (hllByteArr[slotNo >> 1] >> ((slotNo & 1) << 2)) & HllUtil::loNibbleMask;
+    if (nib == HllUtil::AUX_TOKEN) {
+      f(slotNo, auxHashMap->mustFindValueFor(slotNo));
+    } else if (nib + curMin != HllUtil::EMPTY) {
+      f(slotNo, nib + curMin);
+    }
+  }
+}
+
 class Hll4Iterator : public HllPairIterator {
   public:
     Hll4Iterator(Hll4Array& array, const int lengthPairs);
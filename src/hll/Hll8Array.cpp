@@ -3,12 +3,26 @@
  * Apache License 2.0. See LICENSE file at the project root for terms.
  */
 
+#include <algorithm>
 #include <cstring>
 
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#endif
+
 #include "Hll8Array.hpp"
+#include "RegisterScan.hpp"
 
 namespace datasketches {
 
+static inline void prefetchForWrite(const uint8_t* addr) {
+#if defined(_MSC_VER)
+  _mm_prefetch((const char*) addr, _MM_HINT_T0);
+#else
+  __builtin_prefetch(addr, 1);
+#endif
+}
+
 Hll8Iterator::Hll8Iterator(Hll8Array& hllArray, const int lengthPairs)
   : HllPairIterator(lengthPairs),
     hllArray(hllArray)
@@ -20,10 +34,10 @@ int Hll8Iterator::value() {
   return hllArray.hllByteArr[index] & HllUtil::VAL_MASK_6;
 }
 
-Hll8Array::Hll8Array(const int lgConfigK) :
-    HllArray(lgConfigK, TgtHllType::HLL_8) {
+Hll8Array::Hll8Array(const int lgConfigK, std::pmr::memory_resource* resource) :
+    HllArray(lgConfigK, TgtHllType::HLL_8, resource) {
   const int numBytes = hll8ArrBytes(lgConfigK);
-  hllByteArr = new uint8_t[numBytes];
+  hllByteArr = newArray<uint8_t>(numBytes);
   std::fill(hllByteArr, hllByteArr + numBytes, 0);
 }
 
@@ -38,7 +52,7 @@ Hll8Array::~Hll8Array() {
 }
 
 Hll8Array* Hll8Array::copy() {
-  return new Hll8Array(*this);
+  return new (resource) Hll8Array(*this);
 }
 
 std::unique_ptr<PairIterator> Hll8Array::getIterator() {
@@ -54,6 +68,90 @@ void Hll8Array::putSlot(const int slotNo, const int value) {
   hllByteArr[slotNo] = value & HllUtil::VAL_MASK_6;
 }
 
+void Hll8Array::rebuildKxQ() {
+  // curMin is always 0, so numAtCurMin is the number of zeros
+  curMin = 0;
+  if (valueHistogram != nullptr) {
+    std::fill(valueHistogram, valueHistogram + HllUtil::VAL_MASK_6 + 1, 0);
+    countValues(valueHistogram);
+    putKxQFromValueHistogram();
+    return;
+  }
+  RegisterScan::sumInvPow2(hllByteArr, 1 << lgConfigK, 0, kxq0, kxq1, numAtCurMin);
+  invalidateEstimates();
+}
+
+// Same as couponUpdate(coupon) applied to each coupon in turn, restructured for large
+// sketches where most register reads miss cache. HIP depends on update order, so coupons
+// are not regrouped by slot; instead each chunk is applied in two passes:
+// 1. Store the max of old and new value into each register, remembering the old value.
+//    This pass has no data-dependent branches, so the misses overlap, and the registers
+//    PREFETCH_DISTANCE coupons ahead are prefetched once the array outgrows L1. Repeated
+//    slots within a chunk see the earlier store, exactly as in sequential updates.
+// 2. Walk the chunk in order and apply the HIP and KxQ updates for coupons that raised
+//    a register, with the accumulators held in locals.
+// HLL mode is final, so the whole block is always applied.
+HllSketchImpl* Hll8Array::couponUpdate(const int coupons[], const int len, int& numApplied) {
+  const int configK = 1 << lgConfigK;
+  const int configKmask = configK - 1;
+  const bool prefetch = lgConfigK >= LG_K_PREFETCH;
+  uint8_t oldVals[UPDATE_CHUNK_SIZE];
+
+  double localHipAccum = hipAccum;
+  double localKxq0 = kxq0;
+  double localKxq1 = kxq1;
+  int numZeros = numAtCurMin;
+  bool changed = false;
+  for (int start = 0; start < len; start += UPDATE_CHUNK_SIZE) {
+    const int chunkLen = ((len - start) < UPDATE_CHUNK_SIZE) ? (len - start) : UPDATE_CHUNK_SIZE;
+    const int* chunk = coupons + start;
+
+    for (int i = 0; i < chunkLen; ++i) {
+      if (prefetch && (start + i + PREFETCH_DISTANCE < len)) {
+        prefetchForWrite(&hllByteArr[HllUtil::getLow26(chunk[i + PREFETCH_DISTANCE]) & configKmask]);
+      }
+      const int slotNo = HllUtil::getLow26(chunk[i]) & configKmask;
+      const uint8_t newVal = (uint8_t) HllUtil::getValue(chunk[i]);
+      const uint8_t curVal = hllByteArr[slotNo];
+      oldVals[i] = curVal;
+      hllByteArr[slotNo] = std::max(curVal, newVal);
+    }
+
+    for (int i = 0; i < chunkLen; ++i) {
+      const int newVal = HllUtil::getValue(chunk[i]);
+      const int curVal = oldVals[i];
+      assert(newVal > 0);
+      if (newVal > curVal) {
+        changed = true;
+        // same steps as hipAndKxQIncrementalUpdate()
+        localHipAccum += configK / (localKxq0 + localKxq1);
+        if (curVal < 32) { localKxq0 -= HllUtil::invPow2(curVal); }
+        else             { localKxq1 -= HllUtil::invPow2(curVal); }
+        if (newVal < 32) { localKxq0 += HllUtil::invPow2(newVal); }
+        else             { localKxq1 += HllUtil::invPow2(newVal); }
+        if (curVal == 0) {
+          --numZeros;
+        }
+        if (valueHistogram != nullptr) {
+          --valueHistogram[curVal];
+          ++valueHistogram[newVal];
+        }
+      }
+    }
+  }
+  hipAccum = localHipAccum;
+  kxq0 = localKxq0;
+  kxq1 = localKxq1;
+  numAtCurMin = numZeros;
+  assert(numAtCurMin >= 0);
+  if (changed) {
+    invalidateEstimates();
+  }
+
+  numApplied = len;
+  return this;
+}
+
 int Hll8Array::getHllByteArrBytes() {
   return hll8ArrBytes(lgConfigK);
 }
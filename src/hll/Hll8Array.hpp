@@ -10,9 +10,9 @@
 
 namespace datasketches {
 
-class Hll8Array : public HllArray {
+class Hll8Array final : public HllArray {
   public:
-    explicit Hll8Array(const int lgConfigK);
+    explicit Hll8Array(const int lgConfigK, std::pmr::memory_resource* resource);
     explicit Hll8Array(Hll8Array& that);
 
     virtual ~Hll8Array();
@@ -21,15 +21,61 @@ class Hll8Array : public HllArray {
 
     virtual std::unique_ptr<PairIterator> getIterator();
 
+    // Calls f(slotNo, value) for every non-zero register, in slot order, without allocating.
+    template<typename F> void forEachValid(F&& f);
+
     virtual int getSlot(const int slotNo);
     virtual void putSlot(const int slotNo, const int value);
 
+    virtual void rebuildKxQ();
+
     virtual int getHllByteArrBytes();
 
+    virtual HllSketchImpl* couponUpdate(const int coupon);
+    virtual HllSketchImpl* couponUpdate(const int coupons[], const int len, int& numApplied);
+
   protected:
     friend class Hll8Iterator;
+
+  private:
+    // smallest lgConfigK whose registers overflow a typical 32KB L1 data cache
+    static const int LG_K_PREFETCH = 15;
+    // how many coupons ahead of the current one a batch update prefetches
+    static const int PREFETCH_DISTANCE = 16;
+    // coupons per pass of a batch update
+    static const int UPDATE_CHUNK_SIZE = 64;
 };
 
+// Same as HllArray::couponUpdate() with the register access inlined. Defined here so
+// HllSketch can inline it into the update path.
+inline HllSketchImpl* Hll8Array::couponUpdate(const int coupon) {
+  const int slotNo = HllUtil::getLow26(coupon) & ((1 << lgConfigK) - 1);
+  const int newVal = HllUtil::getValue(coupon);
+  assert(newVal > 0);
+
+  const int curVal = hllByteArr[slotNo] & HllUtil::VAL_MASK_6;
+  if (newVal > curVal) {
+    hllByteArr[slotNo] = newVal & HllUtil::VAL_MASK_6;
+    hipAndKxQIncrementalUpdate(*this, curVal, newVal);
+    if (curVal == 0) {
+      decNumAtCurMin(); // interpret numAtCurMin as num zeros
+      assert(getNumAtCurMin() >= 0);
+    }
+  }
+  return this;
+}
+
+template<typename F>
+void Hll8Array::forEachValid(F&& f) {
+  const int numSlots = 1 << lgConfigK;
+  for (int slotNo = 0; slotNo < numSlots; ++slotNo) {
+    const int value = hllByteArr[slotNo] & HllUtil::VAL_MASK_6;
+    if (value != HllUtil::EMPTY) {
+      f(slotNo, value);
+    }
+  }
+}
+
 class Hll8Iterator : public HllPairIterator {
   public:
     Hll8Iterator(Hll8Array& array, const int lengthPairs);
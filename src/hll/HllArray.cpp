@@ -12,40 +12,54 @@
 #include "Hll8Array.hpp"
 #include "Hll4Array.hpp"
 #include "Conversions.hpp"
+#include "RegisterScan.hpp"
 
+#include <algorithm>
 #include <cstring>
 #include <cmath>
 
 namespace datasketches {
 
-HllArray::HllArray(const int lgConfigK, const TgtHllType tgtHllType)
-  : HllSketchImpl(lgConfigK, tgtHllType, CurMode::HLL) {
+HllArray::HllArray(const int lgConfigK, const TgtHllType tgtHllType,
+                   std::pmr::memory_resource* resource)
+  : HllSketchImpl(lgConfigK, tgtHllType, CurMode::HLL, resource) {
   hipAccum = 0.0;
   kxq0 = 1 << lgConfigK;
   kxq1 = 0.0;
   curMin = 0;
   numAtCurMin = 1 << lgConfigK;
   oooFlag = false;
+  valueHistogram = nullptr;
   hllByteArr = nullptr; // allocated in derived class
+  invalidateEstimates();
 }
 
 HllArray::HllArray(HllArray& that)
-  : HllSketchImpl(that.lgConfigK, that.tgtHllType, CurMode::HLL) {
+  : HllSketchImpl(that.lgConfigK, that.tgtHllType, CurMode::HLL, that.resource) {
   hipAccum = that.getHipAccum();
   kxq0 = that.getKxQ0();
   kxq1 = that.getKxQ1();
   curMin = that.getCurMin();
   numAtCurMin = that.getNumAtCurMin();
   oooFlag = that.isOutOfOrderFlag();
+  valueHistogram = nullptr;
+  if (that.valueHistogram != nullptr) {
+    valueHistogram = newArray<int>(HllUtil::VAL_MASK_6 + 1);
+    std::copy(that.valueHistogram, that.valueHistogram + HllUtil::VAL_MASK_6 + 1, valueHistogram);
+  }
+  invalidateEstimates();
 
   // can determine length, so allocate here
   int arrayLen = that.getHllByteArrBytes();
-  hllByteArr = new uint8_t[arrayLen];
+  hllByteArr = newArray<uint8_t>(arrayLen);
   std::copy(that.hllByteArr, that.hllByteArr + arrayLen, hllByteArr);
 }
 
 HllArray::~HllArray() {
-  delete hllByteArr;
+  const int arrayLen =
+      (tgtHllType == TgtHllType::HLL_4) ? hll4ArrBytes(lgConfigK) : hll8ArrBytes(lgConfigK);
+  deleteArray(hllByteArr, arrayLen);
+  deleteArray(valueHistogram, HllUtil::VAL_MASK_6 + 1);
 }
 
 HllArray* HllArray::copyAs(const TgtHllType tgtHllType) {
@@ -59,12 +73,13 @@ HllArray* HllArray::copyAs(const TgtHllType tgtHllType) {
   }
 }
 
-HllArray* HllArray::newHll(const int lgConfigK, const TgtHllType tgtHllType) {
+HllArray* HllArray::newHll(const int lgConfigK, const TgtHllType tgtHllType,
+                           std::pmr::memory_resource* resource) {
   switch (tgtHllType) {
     case HLL_8:
-      return (HllArray*) new Hll8Array(lgConfigK);
+      return (HllArray*) new (resource) Hll8Array(lgConfigK, resource);
     case HLL_4:
-      return (HllArray*) new Hll4Array(lgConfigK);
+      return (HllArray*) new (resource) Hll4Array(lgConfigK, resource);
     default:
       throw std::invalid_argument("Only HLL_4, HLL_8 currently supported");
   }
@@ -89,7 +104,7 @@ HllSketchImpl* HllArray::couponUpdate(const int coupon) { // used by HLL_8 (and
 }
 
 HllSketchImpl* HllArray::reset() {
-  return new CouponList(lgConfigK, tgtHllType, CurMode::LIST);
+  return new (resource) CouponList(lgConfigK, tgtHllType, CurMode::LIST, resource);
 }
 
 double HllArray::getEstimate() {
@@ -116,50 +131,54 @@ double HllArray::getEstimate() {
  */
 double HllArray::getLowerBound(const int numStdDev) {
   HllUtil::checkNumStdDev(numStdDev);
-  const int configK = 1 << lgConfigK;
-  const double numNonZeros = ((curMin == 0) ? (configK - numAtCurMin) : configK);
-
-  double estimate;
-  double rseFactor;
-  if (oooFlag) {
-    estimate = getCompositeEstimate();
-    rseFactor = HllUtil::HLL_NON_HIP_RSE_FACTOR;
-  } else {
-    estimate = hipAccum;
-    rseFactor = HllUtil::HLL_HIP_RSE_FACTOR;
-  }
-
-  double relErr;
-  if (lgConfigK > 12) {
-    relErr = (numStdDev * rseFactor) / sqrt(configK);
-  } else {
-    relErr = RelativeErrorTables::getRelErr(false, oooFlag, lgConfigK, numStdDev);
+  checkEstimateCache();
+  double bound = cachedLowerBounds[numStdDev - 1].load(std::memory_order_relaxed);
+  if (std::isnan(bound)) {
+    const double estimate = oooFlag ? getCompositeEstimate() : hipAccum;
+    bound = hllLowerBound(lgConfigK, oooFlag, estimate, curMin, numAtCurMin, numStdDev);
+    cachedLowerBounds[numStdDev - 1].store(bound, std::memory_order_relaxed);
   }
-  return fmax(estimate / (1.0 + relErr), numNonZeros);
+  return bound;
 }
 
 double HllArray::getUpperBound(const int numStdDev) {
   HllUtil::checkNumStdDev(numStdDev);
+  checkEstimateCache();
+  double bound = cachedUpperBounds[numStdDev - 1].load(std::memory_order_relaxed);
+  if (std::isnan(bound)) {
+    const double estimate = oooFlag ? getCompositeEstimate() : hipAccum;
+    bound = hllUpperBound(lgConfigK, oooFlag, estimate, numStdDev);
+    cachedUpperBounds[numStdDev - 1].store(bound, std::memory_order_relaxed);
+  }
+  return bound;
+}
+
+double HllArray::hllLowerBound(const int lgConfigK, const bool oooFlag, const double estimate,
+                               const int curMin, const int numAtCurMin, const int numStdDev) {
   const int configK = 1 << lgConfigK;
+  const double numNonZeros = ((curMin == 0) ? (configK - numAtCurMin) : configK);
+  const double relErr = hllRelErr(false, lgConfigK, oooFlag, numStdDev);
+  return fmax(estimate / (1.0 + relErr), numNonZeros);
+}
 
-  double estimate;
-  double rseFactor;
-  if (oooFlag) {
-    estimate = getCompositeEstimate();
-    rseFactor = HllUtil::HLL_NON_HIP_RSE_FACTOR;
-  } else {
-    estimate = hipAccum;
-    rseFactor = HllUtil::HLL_HIP_RSE_FACTOR;
-  }
+double HllArray::hllUpperBound(const int lgConfigK, const bool oooFlag, const double estimate,
+                               const int numStdDev) {
+  const double relErr = hllRelErr(true, lgConfigK, oooFlag, numStdDev);
+  return estimate / (1.0 + relErr);
+}
 
+double HllArray::hllRelErr(const bool upperBound, const int lgConfigK, const bool oooFlag,
+                           const int numStdDev) {
+  if (lgConfigK <= 12) {
+    return RelativeErrorTables::getRelErr(upperBound, oooFlag, lgConfigK, numStdDev);
+  }
   // TODO: add RelativeErrorTables to handle -1 case
-  double relErr;
-  if (lgConfigK > 12) {
-    relErr = (-1.0) * (numStdDev * rseFactor) / sqrt(configK);
-  } else {
-    relErr = RelativeErrorTables::getRelErr(true, oooFlag, lgConfigK, numStdDev);
+  const int configK = 1 << lgConfigK;
+  const double rseFactor = oooFlag ? HllUtil::HLL_NON_HIP_RSE_FACTOR : HllUtil::HLL_HIP_RSE_FACTOR;
+  if (upperBound) {
+    return (-1.0) * (numStdDev * rseFactor) / sqrt(configK);
   }
-  return estimate / (1.0 + relErr);
+  return (numStdDev * rseFactor) / sqrt(configK);
 }
 
 /**
@@ -169,8 +188,60 @@ double HllArray::getUpperBound(const int numStdDev) {
  * @return the composite estimate
  */
 // Original C: again-two-registers.c hhb_get_composite_estimate L1489
+// Polled estimates are served from the cache until the sketch changes.
 double HllArray::getCompositeEstimate() {
-  const double rawEst = getHllRawEstimate(lgConfigK, kxq0 + kxq1);
+  checkEstimateCache();
+  double estimate = cachedCompositeEstimate.load(std::memory_order_relaxed);
+  if (std::isnan(estimate)) {
+    estimate = hllCompositeEstimate(lgConfigK, kxq0 + kxq1, curMin, numAtCurMin);
+    cachedCompositeEstimate.store(estimate, std::memory_order_relaxed);
+  }
+  return estimate;
+}
+
+// O(1) with the value histogram enabled, otherwise one pass over the registers to count
+// those at the largest value.
+double HllArray::getImprovedEstimate() {
+  checkEstimateCache();
+  double estimate = cachedImprovedEstimate.load(std::memory_order_relaxed);
+  if (std::isnan(estimate)) {
+    int numAtMax;
+    if (valueHistogram != nullptr) {
+      numAtMax = valueHistogram[HllUtil::VAL_MASK_6];
+    } else {
+      int counts[HllUtil::VAL_MASK_6 + 1] = {0};
+      countValues(counts);
+      numAtMax = counts[HllUtil::VAL_MASK_6];
+    }
+    const int numZeros = (curMin == 0) ? numAtCurMin : 0;
+    estimate = hllImprovedEstimate(lgConfigK, kxq0 + kxq1, numZeros, numAtMax);
+    cachedImprovedEstimate.store(estimate, std::memory_order_relaxed);
+  }
+  return estimate;
+}
+
+// Cheap enough for the update path; the cached values are cleared on the next query.
+void HllArray::invalidateEstimates() {
+  estimatesValid.store(false, std::memory_order_relaxed);
+}
+
+// Readers that see the cache valid also see it cleared. Readers racing to clear it may wipe
+// a value another has just stored, which is only recomputed.
+void HllArray::checkEstimateCache() {
+  if (!estimatesValid.load(std::memory_order_acquire)) {
+    cachedCompositeEstimate.store(NAN, std::memory_order_relaxed);
+    cachedImprovedEstimate.store(NAN, std::memory_order_relaxed);
+    for (int i = 0; i < 3; ++i) {
+      cachedLowerBounds[i].store(NAN, std::memory_order_relaxed);
+      cachedUpperBounds[i].store(NAN, std::memory_order_relaxed);
+    }
+    estimatesValid.store(true, std::memory_order_release);
+  }
+}
+
+double HllArray::hllCompositeEstimate(const int lgConfigK, const double kxqSum,
+                                      const int curMin, const int numAtCurMin) {
+  const double rawEst = getHllRawEstimate(lgConfigK, kxqSum);
 
   const double* xArr = CompositeInterpolationXTable::get_x_arr(lgConfigK);
   const int xArrLen = CompositeInterpolationXTable::get_x_arr_length(lgConfigK);
@@ -188,7 +259,8 @@ double HllArray::getCompositeEstimate() {
     return rawEst * factor;
   }
 
-  double adjEst = CubicInterpolation::usingXArrAndYStride(xArr, xArrLen, yStride, rawEst);
+  const int straddle = CompositeInterpolationXTable::find_straddle(lgConfigK, rawEst);
+  double adjEst = CubicInterpolation::usingXArrAndYStride(xArr, xArrLen, yStride, rawEst, straddle);
 
   // We need to completely avoid the linear_counting estimator if it might have a crazy value.
   // Empirical evidence suggests that the threshold 3*k will keep us safe if 2^4 <= k <= 2^21.
@@ -242,30 +314,37 @@ CurMode HllArray::getCurMode() {
 
 void HllArray::putKxQ0(const double kxq0) {
   this->kxq0 = kxq0;
+  invalidateEstimates();
 }
 
 void HllArray::putKxQ1(const double kxq1) {
   this->kxq1 = kxq1;
+  invalidateEstimates();
 }
 
 void HllArray::putHipAccum(const double hipAccum) {
   this->hipAccum = hipAccum;
+  invalidateEstimates();
 }
 
 void HllArray::putCurMin(const int curMin) {
   this->curMin = curMin;
+  invalidateEstimates();
 }
 
 void HllArray::putNumAtCurMin(const int numAtCurMin) {
   this->numAtCurMin = numAtCurMin;
+  invalidateEstimates();
 }
 
 void HllArray::decNumAtCurMin() {
   --numAtCurMin;
+  invalidateEstimates();
 }
 
 void HllArray::addToHipAccum(const double delta) {
   hipAccum += delta;
+  invalidateEstimates();
 }
 
 bool HllArray::isCompact() {
@@ -279,6 +358,7 @@ bool HllArray::isEmpty() {
 
 void HllArray::putOutOfOrderFlag(bool flag) {
   oooFlag = flag;
+  invalidateEstimates();
 }
 
 bool HllArray::isOutOfOrderFlag() {
@@ -318,9 +398,61 @@ AuxHashMap* HllArray::getAuxHashMap() {
   return nullptr;
 }
 
+void HllArray::putValueHistogram(const bool flag) {
+  if (flag == (valueHistogram != nullptr)) { return; }
+  if (!flag) {
+    deleteArray(valueHistogram, HllUtil::VAL_MASK_6 + 1);
+    valueHistogram = nullptr;
+    return;
+  }
+  valueHistogram = newArray<int>(HllUtil::VAL_MASK_6 + 1);
+  std::fill(valueHistogram, valueHistogram + HllUtil::VAL_MASK_6 + 1, 0);
+  countValues(valueHistogram);
+}
+
+const int* HllArray::getValueHistogram() {
+  return valueHistogram;
+}
+
+void HllArray::countValues(int counts[]) {
+  if (tgtHllType == TgtHllType::HLL_8) {
+    RegisterScan::countValues(hllByteArr, 1 << lgConfigK, counts);
+    return;
+  }
+  int numNonZero = 0;
+  auto count = [counts, &numNonZero](const int /*slotNo*/, const int value) {
+    ++counts[value];
+    ++numNonZero;
+  };
+  ((Hll4Array*) this)->forEachValid(count);
+  counts[0] += (1 << lgConfigK) - numNonZero;
+}
+
+// Each count times a power of 2 is exact, and so are the sums (see RegisterScan), so the
+// result matches an accumulation over the registers.
+void HllArray::putKxQFromValueHistogram() {
+  double sum0 = 0.0;
+  double sum1 = 0.0;
+  for (int value = 0; value < 32; ++value) {
+    sum0 += valueHistogram[value] * HllUtil::invPow2(value);
+  }
+  for (int value = 32; value <= HllUtil::VAL_MASK_6; ++value) {
+    sum1 += valueHistogram[value] * HllUtil::invPow2(value);
+  }
+  kxq0 = sum0;
+  kxq1 = sum1;
+  numAtCurMin = valueHistogram[curMin];
+  invalidateEstimates();
+}
+
 void HllArray::hipAndKxQIncrementalUpdate(HllArray& host, const int oldValue, const int newValue) {
   assert(newValue > oldValue);
 
+  if (host.valueHistogram != nullptr) {
+    --host.valueHistogram[oldValue];
+    ++host.valueHistogram[newValue];
+  }
+
   const int configK = 1 << host.getLgConfigK();
   // update hipAccum BEFORE updating kxq0 and kxq1
   double kxq0 = host.getKxQ0();
@@ -339,6 +471,53 @@ void HllArray::hipAndKxQIncrementalUpdate(HllArray& host, const int oldValue, co
  * @return the very low range estimate
  */
 //In C: again-two-registers.c hhb_get_improved_linear_counting_estimate L1274
+// sigma(x) = x + sum_{k >= 1} x^(2^k) 2^(k-1), summed until the terms no longer matter
+static double improvedSigma(double x) {
+  if (x == 1.0) { return INFINITY; }
+  double y = 1.0;
+  double z = x;
+  double zPrev;
+  do {
+    x *= x;
+    zPrev = z;
+    z += x * y;
+    y += y;
+  } while (z != zPrev);
+  return z;
+}
+
+// tau(x) = (1 - x - sum_{k >= 1} (1 - x^(2^-k))^2 2^-k) / 3
+static double improvedTau(double x) {
+  if ((x == 0.0) || (x == 1.0)) { return 0.0; }
+  double y = 1.0;
+  double z = 1.0 - x;
+  double zPrev;
+  do {
+    x = std::sqrt(x);
+    zPrev = z;
+    y *= 0.5;
+    z -= (1.0 - x) * (1.0 - x) * y;
+  } while (z != zPrev);
+  return z / 3.0;
+}
+
+// Ertl's improved raw estimator ("New cardinality estimation algorithms for HyperLogLog
+// sketches", 2017, Algorithm 6). It corrects the raw HLL estimate at both ends of the value
+// range in closed form, so it needs no bias tables and no switch to linear counting.
+// Coupon values are at most q + 1 = 63, with the top value as likely as q. The paper's loop
+// z = (z + C_k) / 2 for k = q down to 1 sums C_k 2^-k, which is the KxQ sum without the
+// registers at 0 and q + 1, so only those two counts are needed.
+double HllArray::hllImprovedEstimate(const int lgConfigK, const double kxqSum,
+                                     const int numZeros, const int numAtMax) {
+  const int q = HllUtil::VAL_MASK_6 - 1;
+  const double configK = 1 << lgConfigK;
+  const double middle = kxqSum - numZeros - numAtMax * HllUtil::invPow2(q + 1);
+  const double z = configK * improvedTau(1.0 - numAtMax / configK) * HllUtil::invPow2(q)
+      + middle + configK * improvedSigma(numZeros / configK);
+  const double alphaInf = 0.5 / std::log(2.0);
+  return alphaInf * configK * configK / z;
+}
+
 double HllArray::getHllBitMapEstimate(const int lgConfigK, const int curMin, const int numAtCurMin) {
   const  int configK = 1 << lgConfigK;
   const  int numUnhitBuckets =  ((curMin == 0) ? numAtCurMin : 0);
@@ -353,14 +532,28 @@ double HllArray::getHllBitMapEstimate(const int lgConfigK, const int curMin, con
 }
 
 //In C: again-two-registers.c hhb_get_raw_estimate L1167
-double HllArray::getHllRawEstimate(const int lgConfigK, const double kxqSum) {
+static constexpr double rawEstimateNumerator(const int lgConfigK) {
   const int configK = 1 << lgConfigK;
-  double correctionFactor;
+  double correctionFactor = 0;
   if (lgConfigK == 4) { correctionFactor = 0.673; }
   else if (lgConfigK == 5) { correctionFactor = 0.697; }
   else if (lgConfigK == 6) { correctionFactor = 0.709; }
   else { correctionFactor = 0.7213 / (1.0 + (1.079 / configK)); }
-  const double hyperEst = (correctionFactor * configK * configK) / kxqSum;
+  return correctionFactor * configK * configK;
+}
+
+// correctionFactor * K * K for each lgConfigK, so the estimate costs a single division
+static constexpr double rawEstimateNumerators[] = {
+  rawEstimateNumerator(4), rawEstimateNumerator(5), rawEstimateNumerator(6),
+  rawEstimateNumerator(7), rawEstimateNumerator(8), rawEstimateNumerator(9),
+  rawEstimateNumerator(10), rawEstimateNumerator(11), rawEstimateNumerator(12),
+  rawEstimateNumerator(13), rawEstimateNumerator(14), rawEstimateNumerator(15),
+  rawEstimateNumerator(16), rawEstimateNumerator(17), rawEstimateNumerator(18),
+  rawEstimateNumerator(19), rawEstimateNumerator(20), rawEstimateNumerator(21)
+};
+
+double HllArray::getHllRawEstimate(const int lgConfigK, const double kxqSum) {
+  const double hyperEst = rawEstimateNumerators[lgConfigK - HllUtil::MIN_LOG_K] / kxqSum;
   return hyperEst;
 }
 
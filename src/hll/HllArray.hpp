@@ -8,14 +8,20 @@
 #include "HllSketchImpl.hpp"
 #include "AuxHashMap.hpp"
 
+#include <atomic>
+
 namespace datasketches {
 
+template<int LgK, TgtHllType TgtType> class StaticHllSketch;
+
 class HllArray : public HllSketchImpl {
   public:
-    explicit HllArray(const int lgConfigK, const TgtHllType tgtHllType);
+    explicit HllArray(const int lgConfigK, const TgtHllType tgtHllType,
+                      std::pmr::memory_resource* resource);
     explicit HllArray(HllArray& that);
 
-    static HllArray* newHll(const int lgConfigK, const TgtHllType tgtHllType);
+    static HllArray* newHll(const int lgConfigK, const TgtHllType tgtHllType,
+                            std::pmr::memory_resource* resource);
 
     virtual ~HllArray();
 
@@ -23,9 +29,11 @@ class HllArray : public HllSketchImpl {
     virtual HllArray* copyAs(const TgtHllType tgtHllType);
 
     virtual HllSketchImpl* couponUpdate(const int coupon);
+    using HllSketchImpl::couponUpdate;
 
     virtual double getEstimate();
     virtual double getCompositeEstimate();
+    virtual double getImprovedEstimate();
     virtual double getLowerBound(const int numStdDev);
     virtual double getUpperBound(const int numStdDev);
 
@@ -71,17 +79,52 @@ class HllArray : public HllSketchImpl {
     void putKxQ1(const double kxq1);
     void putNumAtCurMin(const int numAtCurMin);
 
+    /**
+     * Recomputes kxq0, kxq1 and numAtCurMin from the registers and curMin in a single pass,
+     * for use after registers were written directly with putSlot(). Leaves hipAccum unchanged.
+     */
+    virtual void rebuildKxQ() = 0;
+
+    /**
+     * Enables or disables the value histogram, a count of the registers holding each value
+     * that every register change keeps up to date. With it, estimators that need the whole
+     * distribution of register values take O(64) instead of O(K), and rebuildKxQ() derives
+     * the KxQ registers from the counts. Enabling costs one pass over the registers.
+     */
+    virtual void putValueHistogram(const bool flag);
+    // the number of registers holding each value, VAL_MASK_6 + 1 entries, or null if disabled
+    const int* getValueHistogram();
+
     static int hll4ArrBytes(const int lgConfigK);
     //static int hll6ArrBytes(const int lgConfigK);
     static int hll8ArrBytes(const int lgConfigK);
 
+    // estimators as a function of the HLL state alone
+    static double hllCompositeEstimate(const int lgConfigK, const double kxqSum,
+                                       const int curMin, const int numAtCurMin);
+    // numAtMax is the number of registers at VAL_MASK_6, the largest value a coupon can hold
+    static double hllImprovedEstimate(const int lgConfigK, const double kxqSum,
+                                      const int numZeros, const int numAtMax);
+    static double hllLowerBound(const int lgConfigK, const bool oooFlag, const double estimate,
+                                const int curMin, const int numAtCurMin, const int numStdDev);
+    static double hllUpperBound(const int lgConfigK, const bool oooFlag, const double estimate,
+                                const int numStdDev);
+    // the bound is estimate / (1 + relErr), negative relErr for the upper bound
+    static double hllRelErr(const bool upperBound, const int lgConfigK, const bool oooFlag,
+                            const int numStdDev);
+
   protected:
     // TODO: does this need to be static?
     static void hipAndKxQIncrementalUpdate(HllArray& host, const int oldValue, const int newValue);
-    double getHllBitMapEstimate(const int lgConfigK, const int curMin, const int numAtCurMin);
-    double getHllRawEstimate(const int lgConfigK, const double kxqSum);
+    static double getHllBitMapEstimate(const int lgConfigK, const int curMin, const int numAtCurMin);
+    static double getHllRawEstimate(const int lgConfigK, const double kxqSum);
     virtual AuxHashMap* getAuxHashMap();
 
+    // adds the number of registers holding each value to counts
+    void countValues(int counts[]);
+    // recomputes kxq0, kxq1 and numAtCurMin from valueHistogram, which must be enabled
+    void putKxQFromValueHistogram();
+
     double hipAccum;
     double kxq0;
     double kxq1;
@@ -89,8 +132,24 @@ class HllArray : public HllSketchImpl {
     int curMin; //always zero for Hll6 and Hll8, only used / tracked by Hll4Array
     int numAtCurMin; //interpreted as num zeros when curMin == 0
     bool oooFlag; //Out-Of-Order Flag
+    int* valueHistogram; // VAL_MASK_6 + 1 counts indexed by value, null when disabled
+
+    // Estimator results computed since the last change to the registers or the values above.
+    // Anything that changes them must call invalidateEstimates(). Queries may run on several
+    // threads at once, so each value is computed into a local and then stored; readers that
+    // race at worst compute the same value twice.
+    void invalidateEstimates();
+    void checkEstimateCache(); // clears the cached values if they were invalidated
+    std::atomic<bool> estimatesValid;
+    std::atomic<double> cachedCompositeEstimate; // NaN if not yet computed
+    std::atomic<double> cachedImprovedEstimate;
+    std::atomic<double> cachedLowerBounds[3]; // indexed by numStdDev - 1, NaN if not yet computed
+    std::atomic<double> cachedUpperBounds[3];
 
     friend class Conversions;
+    friend class HllUnion;
+    friend class ConcurrentHllSketch;
+    template<int LgK, TgtHllType TgtType> friend class StaticHllSketch;
 };
 
 
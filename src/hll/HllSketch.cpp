@@ -6,29 +6,81 @@
 #include "HllSketch.hpp"
 #include "HllUtil.hpp"
 #include "CouponList.hpp"
-#include "HllArray.hpp"
+#include "CouponHashSet.hpp"
+#include "Hll4Array.hpp"
+#include "Hll8Array.hpp"
+#include "CubicInterpolation.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <string>
 #include <iostream>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
 namespace datasketches {
 
-HllSketch::HllSketch(const int lgConfigK, const TgtHllType tgtHllType) {
-  hllSketchImpl = new CouponList(HllUtil::checkLgK(lgConfigK), tgtHllType, LIST);
-}
+HllSketch::HllSketch(const int lgConfigK, const TgtHllType tgtHllType)
+  : HllSketch(lgConfigK, tgtHllType, HashType::MURMUR3) {}
+
+HllSketch::HllSketch(const int lgConfigK, const TgtHllType tgtHllType, const HashType hashType)
+  : HllSketch(lgConfigK, tgtHllType, hashType, std::pmr::get_default_resource()) {}
+
+HllSketch::HllSketch(const int lgConfigK, const TgtHllType tgtHllType, const HashType hashType,
+                     std::pmr::memory_resource* resource)
+  : BaseHllSketch(hashType),
+    state(new (resource) CouponList(HllUtil::checkLgK(lgConfigK), tgtHllType, LIST, resource)),
+    incrementalShift(false),
+    valueHistogram(false) {}
 
 HllSketch::~HllSketch() {
-  delete hllSketchImpl;
+  delete getImpl();
+}
+
+HllSketch::HllSketch(const HllSketch& that)
+  : BaseHllSketch(that.hashType),
+    incrementalShift(that.incrementalShift),
+    valueHistogram(that.valueHistogram) {
+  putImpl(that.getImpl()->copy());
+}
+
+HllSketch::HllSketch(HllSketchImpl* that, const HashType hashType)
+  : BaseHllSketch(hashType),
+    incrementalShift(false),
+    valueHistogram(false) {
+  putImpl(that);
 }
 
-HllSketch::HllSketch(const HllSketch& that) {
-  hllSketchImpl = that.hllSketchImpl->copy();
+HllSketchImpl* HllSketch::getImpl() const {
+  return std::visit([](auto* impl) -> HllSketchImpl* { return impl; }, state);
 }
 
-HllSketch::HllSketch(HllSketchImpl* that) {
-  hllSketchImpl = that;
+void HllSketch::putImpl(HllSketchImpl* impl) {
+  switch (impl->getCurMode()) {
+    case LIST:
+      state = static_cast<CouponList*>(impl);
+      break;
+    case SET:
+      state = static_cast<CouponHashSet*>(impl);
+      break;
+    case HLL:
+      if (impl->getTgtHllType() == HLL_4) {
+        Hll4Array* hll4 = static_cast<Hll4Array*>(impl);
+        if (incrementalShift) { hll4->putIncrementalShift(true); }
+        if (valueHistogram) { hll4->putValueHistogram(true); }
+        state = hll4;
+      } else {
+        Hll8Array* hll8 = static_cast<Hll8Array*>(impl);
+        if (valueHistogram) { hll8->putValueHistogram(true); }
+        state = hll8;
+      }
+      break;
+    default:
+      throw std::runtime_error("Sketch state error: Invalid CurMode");
+  }
 }
 
 HllSketch* HllSketch::copy() {
@@ -36,19 +88,68 @@ HllSketch* HllSketch::copy() {
 }
 
 HllSketch* HllSketch::copyAs(const TgtHllType tgtHllType) {
-  return new HllSketch(hllSketchImpl->copyAs(tgtHllType));
+  HllSketch* result = new HllSketch(getImpl()->copyAs(tgtHllType), hashType);
+  result->putIncrementalShift(incrementalShift);
+  result->putValueHistogram(valueHistogram);
+  return result;
+}
+
+void HllSketch::putIncrementalShift(const bool flag) {
+  incrementalShift = flag;
+  if (Hll4Array** hll4 = std::get_if<Hll4Array*>(&state)) {
+    (*hll4)->putIncrementalShift(flag);
+    (*hll4)->putValueHistogram(valueHistogram);
+  }
+}
+
+bool HllSketch::isIncrementalShift() {
+  return incrementalShift;
+}
+
+void HllSketch::putValueHistogram(const bool flag) {
+  valueHistogram = flag;
+  if (getImpl()->getCurMode() == HLL) {
+    ((HllArray*) getImpl())->putValueHistogram(flag);
+  }
+}
+
+bool HllSketch::isValueHistogram() {
+  return valueHistogram;
 }
 
 void HllSketch::reset() {
-  hllSketchImpl = hllSketchImpl->reset();
+  HllSketchImpl* oldImpl = getImpl();
+  putImpl(oldImpl->reset());
+  delete oldImpl;
 }
 
+// The calls below name the concrete class so they bind statically; the impl returns a
+// new object only when the mode changes.
 void HllSketch::couponUpdate(int coupon) {
   if (coupon == HllUtil::EMPTY) { return; }
-  HllSketchImpl* result = this->hllSketchImpl->couponUpdate(coupon);
-  if (result != this->hllSketchImpl) {
-    delete this->hllSketchImpl;
-    this->hllSketchImpl = result;
+  std::visit([this, coupon](auto* impl) {
+    typedef typename std::remove_pointer<decltype(impl)>::type Impl;
+    HllSketchImpl* result = impl->Impl::couponUpdate(coupon);
+    if (result != impl) {
+      delete impl;
+      putImpl(result);
+    }
+  }, state);
+}
+
+void HllSketch::couponUpdate(const int coupons[], const int len) {
+  int numDone = 0;
+  while (numDone < len) {
+    std::visit([this, coupons, len, &numDone](auto* impl) {
+      typedef typename std::remove_pointer<decltype(impl)>::type Impl;
+      int numApplied = 0;
+      HllSketchImpl* result = impl->Impl::couponUpdate(coupons + numDone, len - numDone, numApplied);
+      if (result != impl) {
+        delete impl;
+        putImpl(result);
+      }
+      numDone += numApplied;
+    }, state);
   }
 }
 
@@ -75,7 +176,7 @@ std::ostream& HllSketch::to_string(std::ostream& os, const bool summary,
        << "  UB             : " << getUpperBound(1) << std::endl
        << "  OutOfOrder flag: " << isOutOfOrderFlag() << std::endl;
     if (getCurMode() == HLL) {
-      HllArray* hllArray = (HllArray*) hllSketchImpl;
+      HllArray* hllArray = (HllArray*) getImpl();
       os << "  CurMin       : " << hllArray->getCurMin() << std::endl
          << "  NumAtCurMin  : " << hllArray->getNumAtCurMin() << std::endl
          << "  HipAccum     : " << hllArray->getHipAccum() << std::endl
@@ -83,7 +184,7 @@ std::ostream& HllSketch::to_string(std::ostream& os, const bool summary,
          << "  KxQ1         : " << hllArray->getKxQ1() << std::endl;
     } else {
       os << "  Coupon count : "
-         << std::to_string(((AbstractCoupons*) hllSketchImpl)->getCouponCount()) << std::endl;
+         << std::to_string(((AbstractCoupons*) getImpl())->getCouponCount()) << std::endl;
     }
   }
 
@@ -103,7 +204,7 @@ std::ostream& HllSketch::to_string(std::ostream& os, const bool summary,
   }
   if (auxDetail) {
     if ((getCurMode() == HLL) && (getTgtHllType() == HLL_4)) {
-      HllArray* hllArray = (HllArray*) hllSketchImpl;
+      HllArray* hllArray = (HllArray*) getImpl();
       std::unique_ptr<PairIterator> auxItr = hllArray->getAuxIterator();
       if (auxItr != nullptr) {
         os << "### HLL SKETCH AUX DETAIL: " << std::endl
@@ -125,59 +226,67 @@ std::ostream& HllSketch::to_string(std::ostream& os, const bool summary,
 }
 
 double HllSketch::getEstimate() {
-  return hllSketchImpl->getEstimate();
+  return getImpl()->getEstimate();
 }
 
 double HllSketch::getCompositeEstimate() {
-  return hllSketchImpl->getCompositeEstimate();
+  return getImpl()->getCompositeEstimate();
+}
+
+double HllSketch::getImprovedEstimate() {
+  return getImpl()->getImprovedEstimate();
 }
 
 double HllSketch::getLowerBound(int numStdDev) {
-  return hllSketchImpl->getLowerBound(numStdDev);
+  return getImpl()->getLowerBound(numStdDev);
 }
 
 double HllSketch::getUpperBound(int numStdDev) {
-  return hllSketchImpl->getUpperBound(numStdDev);
+  return getImpl()->getUpperBound(numStdDev);
 }
 
 CurMode HllSketch::getCurMode() {
-  return hllSketchImpl->getCurMode();
+  return getImpl()->getCurMode();
 }
 
 int HllSketch::getLgConfigK() {
-  return hllSketchImpl->getLgConfigK();
+  return getImpl()->getLgConfigK();
 }
 
 TgtHllType HllSketch::getTgtHllType() {
-  return hllSketchImpl->getTgtHllType();
+  return getImpl()->getTgtHllType();
 }
 
 bool HllSketch::isOutOfOrderFlag() {
-  return hllSketchImpl->isOutOfOrderFlag();
+  return getImpl()->isOutOfOrderFlag();
+}
+
+std::pmr::memory_resource* HllSketch::getResource() {
+  return getImpl()->getResource();
 }
 
 int HllSketch::getUpdatableSerializationBytes() {
-  return hllSketchImpl->getUpdatableSerializationBytes();
+  return getImpl()->getUpdatableSerializationBytes();
 }
 
 int HllSketch::getCompactSerializationBytes() {
-  return hllSketchImpl->getCompactSerializationBytes();
+  return getImpl()->getCompactSerializationBytes();
 }
 
 bool HllSketch::isCompact() {
-  return hllSketchImpl->isCompact();
+  return getImpl()->isCompact();
 }
 
 bool HllSketch::isEmpty() {
-  return hllSketchImpl->isEmpty();
+  return getImpl()->isEmpty();
 }
 
 std::unique_ptr<PairIterator> HllSketch::getIterator() {
-  return hllSketchImpl->getIterator();
+  return getImpl()->getIterator();
 }
 
 std::string HllSketch::type_as_string() {
-  switch (hllSketchImpl->getTgtHllType()) {
+  switch (getImpl()->getTgtHllType()) {
     case TgtHllType::HLL_4:
       return std::string("HLL_4");
     case TgtHllType::HLL_8:
@@ -188,7 +297,7 @@ std::string HllSketch::type_as_string() {
 }
 
 std::string HllSketch::mode_as_string() {
-  switch (hllSketchImpl->getCurMode()) {
+  switch (getImpl()->getCurMode()) {
     case LIST:
       return std::string("LIST");
     case SET:
@@ -212,5 +321,93 @@ int HllSketch::getMaxUpdatableSerializationBytes(const int lgConfigK,
   return HllUtil::HLL_BYTE_ARR_START + arrBytes;
 }
 
+// sketches gathered before each bounds pass; the gathered state stays in L1
+static const size_t ESTIMATE_BLOCK_SIZE = 256;
+// below this many sketches per thread, starting a thread costs more than it saves
+static const size_t MIN_ESTIMATES_PER_THREAD = 16384;
+
+void HllSketch::getEstimates(HllSketch* const sketches[], const size_t numSketches,
+                             const int numStdDev, double estimates[], double lowerBounds[],
+                             double upperBounds[], const int numThreads) {
+  HllUtil::checkNumStdDev(numStdDev);
+
+  // every bound is max(raw / (1 + relErr), floor), so look up each relErr once per call
+  const int numLgK = HllUtil::MAX_LOG_K - HllUtil::MIN_LOG_K + 1;
+  double hllRelErrs[2][2][numLgK]; // [upperBound][oooFlag][lgConfigK - MIN_LOG_K]
+  for (int upper = 0; upper < 2; ++upper) {
+    for (int ooo = 0; ooo < 2; ++ooo) {
+      for (int i = 0; i < numLgK; ++i) {
+        hllRelErrs[upper][ooo][i] =
+            HllArray::hllRelErr(upper == 1, HllUtil::MIN_LOG_K + i, ooo == 1, numStdDev);
+      }
+    }
+  }
+  const double couponRelErr = numStdDev * HllUtil::COUPON_RSE;
+
+  auto estimateRange = [&](const size_t begin, const size_t end) {
+    double raw[ESTIMATE_BLOCK_SIZE];
+    double lowerRelErr[ESTIMATE_BLOCK_SIZE];
+    double upperRelErr[ESTIMATE_BLOCK_SIZE];
+    double lowerFloor[ESTIMATE_BLOCK_SIZE];
+    double floor[ESTIMATE_BLOCK_SIZE]; // of the estimate and the upper bound
+    for (size_t start = begin; start < end; start += ESTIMATE_BLOCK_SIZE) {
+      const size_t n = std::min(ESTIMATE_BLOCK_SIZE, end - start);
+      for (size_t i = 0; i < n; ++i) {
+        std::visit([&, i](auto* impl) {
+          typedef typename std::remove_pointer<decltype(impl)>::type Impl;
+          if constexpr (std::is_base_of<HllArray, Impl>::value) {
+            const int lgConfigK = impl->getLgConfigK();
+            const bool oooFlag = impl->Impl::isOutOfOrderFlag();
+            raw[i] = impl->Impl::getEstimate();
+            lowerRelErr[i] = hllRelErrs[0][oooFlag][lgConfigK - HllUtil::MIN_LOG_K];
+            upperRelErr[i] = hllRelErrs[1][oooFlag][lgConfigK - HllUtil::MIN_LOG_K];
+            const int configK = 1 << lgConfigK;
+            lowerFloor[i] = (impl->getCurMin() == 0) ? (configK - impl->getNumAtCurMin()) : configK;
+            floor[i] = -INFINITY;
+          } else {
+            const int couponCount = impl->couponCount;
+            raw[i] = CubicInterpolation::usingXAndYTables(couponCount);
+            lowerRelErr[i] = couponRelErr;
+            upperRelErr[i] = -couponRelErr;
+            lowerFloor[i] = couponCount;
+            floor[i] = couponCount;
+          }
+        }, sketches[start + i]->state);
+      }
+
+      // the same arithmetic as the single-sketch estimators, vectorized across the block
+      double* est = estimates + start;
+      for (size_t i = 0; i < n; ++i) {
+        est[i] = (raw[i] < floor[i]) ? floor[i] : raw[i];
+      }
+      if (lowerBounds != nullptr) {
+        double* lb = lowerBounds + start;
+        for (size_t i = 0; i < n; ++i) {
+          const double bound = raw[i] / (1.0 + lowerRelErr[i]);
+          lb[i] = (bound < lowerFloor[i]) ? lowerFloor[i] : bound;
+        }
+      }
+      if (upperBounds != nullptr) {
+        double* ub = upperBounds + start;
+        for (size_t i = 0; i < n; ++i) {
+          const double bound = raw[i] / (1.0 + upperRelErr[i]);
+          ub[i] = (bound < floor[i]) ? floor[i] : bound;
+        }
+      }
+    }
+  };
+
+  const size_t maxThreads = std::max(numThreads, 1);
+  const size_t numParts = std::max((size_t) 1,
+      std::min(maxThreads, numSketches / MIN_ESTIMATES_PER_THREAD));
+  std::vector<std::thread> threads;
+  for (size_t p = 0; p + 1 < numParts; ++p) {
+    threads.emplace_back(estimateRange, (numSketches * p) / numParts,
+                         (numSketches * (p + 1)) / numParts);
+  }
+  estimateRange((numSketches * (numParts - 1)) / numParts, numSketches);
+  for (std::thread& thread : threads) { thread.join(); }
+}
+
 
 }
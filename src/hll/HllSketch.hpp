@@ -10,16 +10,42 @@
 #include "HllSketchImpl.hpp"
 
 #include <memory>
+#include <memory_resource>
 #include <iostream>
+#include <variant>
 
 namespace datasketches {
 
 class HllSketchImpl;
+class CouponList;
+class CouponHashSet;
+class Hll4Array;
+class Hll8Array;
+template<int LgK, TgtHllType TgtType> class StaticHllSketch;
+
+/**
+ * The closed set of implementations an HllSketch can hold, one per mode and target type:
+ * LIST, SET, HLL_4 and HLL_8. This only changes how updates are dispatched: switching on
+ * the variant index instead of loading the HllSketchImpl vtable lets the update path call,
+ * and inline, the concrete class. The impl itself is still a separate allocation that the
+ * sketch owns and reaches through a pointer, and a mode change still allocates a new one.
+ */
+typedef std::variant<CouponList*, CouponHashSet*, Hll4Array*, Hll8Array*> HllSketchState;
 
 class HllSketch : public BaseHllSketch {
   public:
     explicit HllSketch(const int lgConfigK);
     explicit HllSketch(const int lgConfigK, const TgtHllType tgtHllType);
+    explicit HllSketch(const int lgConfigK, const TgtHllType tgtHllType, const HashType hashType);
+
+    /**
+     * Allocates everything the sketch holds, in every mode, from the given resource, which
+     * must outlive the sketch. Copies and getResult() allocate from the same resource; the
+     * HllSketch objects they return come from the heap as before. The other constructors use
+     * std::pmr::get_default_resource().
+     */
+    explicit HllSketch(const int lgConfigK, const TgtHllType tgtHllType, const HashType hashType,
+                       std::pmr::memory_resource* resource);
     ~HllSketch();
 
     HllSketch* copy();
@@ -30,14 +56,44 @@ class HllSketch : public BaseHllSketch {
     std::ostream& to_string(std::ostream& os, const bool summary,
                             const bool detail, const bool auxDetail, const bool all);
 
+    // The estimates and bounds are cached until the sketch changes. They may be queried from
+    // several threads at once, as long as none of them updates the sketch.
     double getEstimate();
     double getCompositeEstimate();
+
+    /**
+     * An alternative to getCompositeEstimate() for sketches in HLL mode: Ertl's improved raw
+     * estimator, computed in closed form from the number of registers at each value. It takes
+     * O(1) with the value histogram enabled, see putValueHistogram(), and one pass over the
+     * registers otherwise. In LIST and SET modes it equals getEstimate().
+     */
+    double getImprovedEstimate();
     double getLowerBound(int numStdDev);
     double getUpperBound(int numStdDev);
 
     int getLgConfigK();
     TgtHllType getTgtHllType();
     bool isOutOfOrderFlag();
+    std::pmr::memory_resource* getResource();
+
+    /**
+     * For HLL_4, spreads the O(K) work of raising curMin over the following updates instead
+     * of doing it inside the one update that triggers it, bounding the worst-case update
+     * latency. Estimates are unaffected. HLL_8 ignores this.
+     * @param flag true to enable, false to return to the default eager shifting
+     */
+    void putIncrementalShift(const bool flag);
+    bool isIncrementalShift();
+
+    /**
+     * In HLL mode, keeps a count of the registers holding each value (64 counters) up to date
+     * on every register change, so estimators that need the whole distribution of register
+     * values run in O(64) instead of O(K). Costs a pass over the registers when enabled in
+     * HLL mode or on promotion to it, and two counter updates per register change after.
+     * @param flag true to enable, false to disable
+     */
+    void putValueHistogram(const bool flag);
+    bool isValueHistogram();
 
     bool isCompact();
     bool isEmpty();
@@ -57,8 +113,36 @@ class HllSketch : public BaseHllSketch {
     */
     static int getMaxUpdatableSerializationBytes(const int lgK, TgtHllType tgtHllType);
 
+    /**
+     * Fills the estimates and bounds of many sketches in one call, with the same values as
+     * getEstimate(), getLowerBound(numStdDev) and getUpperBound(numStdDev) on each. The
+     * sketches are processed in blocks: the state each estimator needs is read from every
+     * sketch of a block, then the bounds of the whole block are computed in one branch-free
+     * loop. Large inputs are split into contiguous ranges across threads.
+     *
+     * <p>No sketch may be updated during the call. A sketch may appear more than once.
+     *
+     * @param sketches the sketches to estimate
+     * @param numSketches the number of sketches
+     * @param numStdDev the number of standard deviations for the bounds, 1, 2 or 3
+     * @param estimates receives numSketches estimates
+     * @param lowerBounds receives numSketches lower bounds, or null to skip them
+     * @param upperBounds receives numSketches upper bounds, or null to skip them
+     * @param numThreads the maximum number of threads to use, including the calling one
+     */
+    static void getEstimates(HllSketch* const sketches[], const size_t numSketches,
+                             const int numStdDev, double estimates[], double lowerBounds[],
+                             double upperBounds[], const int numThreads);
+
   protected:
-    HllSketchImpl* hllSketchImpl;
+    HllSketchState state;
+    bool incrementalShift;
+    bool valueHistogram;
+
+    // the current impl as its base type
+    HllSketchImpl* getImpl() const;
+    // replaces the current impl without deleting it; the state is chosen from its mode and type
+    void putImpl(HllSketchImpl* impl);
 
     virtual std::unique_ptr<PairIterator> getIterator();
 
@@ -66,14 +150,18 @@ class HllSketch : public BaseHllSketch {
 
     // copy constructors
     HllSketch(const HllSketch& that);
-    HllSketch(HllSketchImpl* that);
+    HllSketch(HllSketchImpl* that, const HashType hashType);
 
     virtual void couponUpdate(int coupon);
+    virtual void couponUpdate(const int coupons[], const int len);
 
     std::string type_as_string();
     std::string mode_as_string();
 
     friend class HllUnion;
+    friend class ConcurrentHllSketch;
+    friend class ShardedHllSketch;
+    template<int LgK, TgtHllType TgtType> friend class StaticHllSketch;
 };
 
 std::ostream& operator<<(std::ostream& os, HllSketch& sketch);
@@ -7,18 +7,14 @@
 
 namespace datasketches {
 
-static int numImpls = 0;
-
-HllSketchImpl::HllSketchImpl(const int lgConfigK, const TgtHllType tgtHllType, const CurMode curMode)
-  : lgConfigK(lgConfigK),
+HllSketchImpl::HllSketchImpl(const int lgConfigK, const TgtHllType tgtHllType, const CurMode curMode,
+                             std::pmr::memory_resource* resource)
+  : ResourceAllocated(resource),
+    lgConfigK(lgConfigK),
     tgtHllType(tgtHllType),
-    curMode(curMode)
-{ std::cerr << "Num impls: " << ++numImpls << "\n";
- }
+    curMode(curMode) {}
 
-HllSketchImpl::~HllSketchImpl() {
-  std::cerr << "Num impls: " << --numImpls << "\n";
-}
+HllSketchImpl::~HllSketchImpl() {}
 
 TgtHllType HllSketchImpl::getTgtHllType() {
   return tgtHllType;
@@ -28,6 +24,18 @@ int HllSketchImpl::getLgConfigK() {
   return lgConfigK;
 }
 
+HllSketchImpl* HllSketchImpl::couponUpdate(const int coupons[], const int len, int& numApplied) {
+  for (int i = 0; i < len; ++i) {
+    HllSketchImpl* result = couponUpdate(coupons[i]);
+    if (result != this) {
+      numApplied = i + 1;
+      return result;
+    }
+  }
+  numApplied = len;
+  return this;
+}
+
 CurMode HllSketchImpl::getCurMode() {
   return curMode;
 }
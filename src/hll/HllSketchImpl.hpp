@@ -6,6 +6,7 @@
 #pragma once
 
 #include "HllSketch.hpp"
+#include "ResourceAllocated.hpp"
 
 #include <memory>
 
@@ -13,9 +14,11 @@ namespace datasketches {
 
 class HllSketch;
 
-class HllSketchImpl {
+// Impls and their arrays are allocated from the resource they were built with.
+class HllSketchImpl : public ResourceAllocated {
   public:
-    HllSketchImpl(const int lgConfigK, const TgtHllType tgtHllType, const CurMode curMode);
+    HllSketchImpl(const int lgConfigK, const TgtHllType tgtHllType, const CurMode curMode,
+                  std::pmr::memory_resource* resource);
     virtual ~HllSketchImpl();
 
     virtual HllSketchImpl* copy() = 0;
@@ -24,10 +27,20 @@ class HllSketchImpl {
 
     virtual HllSketchImpl* couponUpdate(int coupon) = 0;
 
+    /**
+     * Applies coupons in order until either all have been used or the mode changes.
+     * @param coupons the coupons to apply
+     * @param len the number of coupons
+     * @param numApplied set to the number of coupons consumed
+     * @return the impl holding the result, which is a new object after a mode change
+     */
+    virtual HllSketchImpl* couponUpdate(const int coupons[], const int len, int& numApplied);
+
     CurMode getCurMode();
 
     virtual double getEstimate() = 0;
     virtual double getCompositeEstimate() = 0;
+    virtual double getImprovedEstimate() = 0;
     virtual double getUpperBound(int numStdDev) = 0;
     virtual double getLowerBound(int numStdDev) = 0;
 
@@ -0,0 +1,55 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#include "HllSketchPool.hpp"
+
+namespace datasketches {
+
+static std::pmr::pool_options slabOptions() {
+  std::pmr::pool_options options;
+  options.largest_required_pool_block = HllSketchPool::MAX_POOLED_BYTES;
+  return options;
+}
+
+HllSketchPool::HllSketchPool()
+  : HllSketchPool(std::pmr::get_default_resource()) {}
+
+HllSketchPool::HllSketchPool(std::pmr::memory_resource* upstream)
+  : slabs(slabOptions(), upstream) {}
+
+HllSketchPool::~HllSketchPool() {
+  // the slabs release themselves
+}
+
+HllSketch* HllSketchPool::newSketch(const int lgConfigK, const TgtHllType tgtHllType) {
+  return newSketch(lgConfigK, tgtHllType, HashType::MURMUR3);
+}
+
+HllSketch* HllSketchPool::newSketch(const int lgConfigK, const TgtHllType tgtHllType,
+                                    const HashType hashType) {
+  void* block = slabs.allocate(sizeof(HllSketch), alignof(HllSketch));
+  try {
+    return new (block) HllSketch(lgConfigK, tgtHllType, hashType, &slabs);
+  } catch (...) {
+    slabs.deallocate(block, sizeof(HllSketch), alignof(HllSketch));
+    throw;
+  }
+}
+
+void HllSketchPool::destroySketch(HllSketch* sketch) {
+  sketch->~HllSketch();
+  slabs.deallocate(sketch, sizeof(HllSketch), alignof(HllSketch));
+}
+
+// Everything a pooled sketch owns is in the slabs, so nothing is left to destroy.
+void HllSketchPool::release() {
+  slabs.release();
+}
+
+std::pmr::memory_resource* HllSketchPool::getResource() {
+  return &slabs;
+}
+
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#pragma once
+
+#include "HllSketch.hpp"
+
+#include <memory_resource>
+
+namespace datasketches {
+
+/**
+ * Memory for very many small sketches, such as one per group of a group-by. A sketch from
+ * newSketch() is allocated entirely from size-class slabs: each class cuts blocks of one
+ * size out of large chunks, so the sketch object, its impl and its coupon array carry no
+ * malloc headers, and the arrays a sketch gives up when it grows or changes mode are
+ * reused by the next sketch that needs that size. Blocks above MAX_POOLED_BYTES, the
+ * registers of large HLL sketches, come from the upstream resource.
+ *
+ * <p>Sketches are freed one at a time with destroySketch(), or all at once with release(),
+ * which hands the slabs back without visiting the sketches. Unions that should share the
+ * pool can be built with getResource().
+ *
+ * <p>The pool is single threaded: it, its sketches and any union built on getResource() may
+ * only be used by one thread at a time. The parallel HllUnion::update() is allowed, since
+ * its worker threads only read the sketches and allocate outside the union's resource. The
+ * pool must outlive its sketches, and copies of them.
+ */
+class HllSketchPool final {
+  public:
+    // the largest block served from a slab; 4 KB holds the registers of HLL_8 at lgK 12
+    static const int MAX_POOLED_BYTES = 4096;
+
+    explicit HllSketchPool();
+    explicit HllSketchPool(std::pmr::memory_resource* upstream);
+    HllSketchPool(const HllSketchPool& that) = delete;
+    HllSketchPool& operator=(const HllSketchPool& that) = delete;
+
+    // releases every sketch still in the pool
+    ~HllSketchPool();
+
+    HllSketch* newSketch(const int lgConfigK, const TgtHllType tgtHllType);
+    HllSketch* newSketch(const int lgConfigK, const TgtHllType tgtHllType, const HashType hashType);
+
+    // frees a sketch from newSketch()
+    void destroySketch(HllSketch* sketch);
+
+    // frees every sketch from newSketch() at once, leaving the pool empty and reusable
+    void release();
+
+    // the slabs, which are not thread safe, for unions that share the pool
+    std::pmr::memory_resource* getResource();
+
+  private:
+    std::pmr::unsynchronized_pool_resource slabs;
+};
+
+}
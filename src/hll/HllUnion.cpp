@@ -7,17 +7,35 @@
 
 #include "HllSketchImpl.hpp"
 #include "HllArray.hpp"
+#include "CouponList.hpp"
+#include "Hll4Array.hpp"
 #include "HllUtil.hpp"
+#include "RegisterScan.hpp"
+
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <thread>
+#include <vector>
 
 namespace datasketches {
 
 HllUnion::HllUnion(const int lgMaxK)
-  : lgMaxK(HllUtil::checkLgK(lgMaxK)) {
-  gadget = new HllSketch(lgMaxK, TgtHllType::HLL_8);
+  : HllUnion(lgMaxK, HashType::MURMUR3) {}
+
+HllUnion::HllUnion(const int lgMaxK, const HashType hashType)
+  : HllUnion(lgMaxK, hashType, std::pmr::get_default_resource()) {}
+
+HllUnion::HllUnion(const int lgMaxK, const HashType hashType,
+                   std::pmr::memory_resource* resource)
+  : BaseHllSketch(hashType),
+    lgMaxK(HllUtil::checkLgK(lgMaxK)) {
+  gadget = new HllSketch(lgMaxK, TgtHllType::HLL_8, hashType, resource);
 }
 
 HllUnion::HllUnion(HllSketch& sketch)
-  : lgMaxK(sketch.getLgConfigK()) {
+  : BaseHllSketch(sketch.getHashType()),
+    lgMaxK(sketch.getLgConfigK()) {
   TgtHllType tgtHllType = sketch.getTgtHllType();
   if (tgtHllType != TgtHllType::HLL_8) {
     throw std::invalid_argument("HllUnion can only wrap HLL_8 sketches");
@@ -40,20 +58,96 @@ HllSketch* HllUnion::getResult(TgtHllType tgtHllType) {
 }
 
 void HllUnion::update(HllSketch* sketch) {
-  unionImpl(sketch->hllSketchImpl, lgMaxK);
+  checkHashType(*sketch);
+  unionImpl(sketch->getImpl(), lgMaxK);
 }
 
 void HllUnion::update(HllSketch& sketch) {
-  unionImpl(sketch.hllSketchImpl, lgMaxK);
+  checkHashType(sketch);
+  unionImpl(sketch.getImpl(), lgMaxK);
+}
+
+void HllUnion::update(HllSketch* const sketches[], const size_t numSketches,
+                      const int numThreads) {
+  bool allHll = gadget->isEmpty() || (gadget->getCurMode() == CurMode::HLL);
+  for (size_t i = 0; i < numSketches; ++i) {
+    checkHashType(*sketches[i]);
+    allHll &= sketches[i]->isEmpty() || (sketches[i]->getCurMode() == CurMode::HLL);
+  }
+  const size_t numParts = std::min(numSketches, (size_t) std::max(numThreads, 1));
+  if (!allHll || (numParts < 2)) {
+    for (size_t i = 0; i < numSketches; ++i) {
+      unionImpl(sketches[i]->getImpl(), lgMaxK);
+    }
+    return;
+  }
+
+  // the gadget's resource need not be thread safe, so it is only used by the final fold on
+  // this thread, and the parts are built on a resource that is
+  std::vector<HllUnion*> parts(numParts);
+  for (size_t p = 0; p < numParts; ++p) {
+    parts[p] = new HllUnion(lgMaxK, hashType, std::pmr::new_delete_resource());
+  }
+  // runs task(p) for each p in [0, count) on its own thread, the last on this one
+  std::vector<std::exception_ptr> errors(numParts);
+  auto runAll = [&errors](const size_t count, const std::function<void(size_t)>& task) {
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < count; ++p) {
+      auto guarded = [&errors, &task, p]() {
+        try { task(p); } catch (...) { errors[p] = std::current_exception(); }
+      };
+      if (p + 1 < count) { threads.emplace_back(guarded); } else { guarded(); }
+    }
+    for (std::thread& thread : threads) { thread.join(); }
+  };
+
+  // leaves: contiguous ranges, so each part's first sketch comes before the next part's
+  runAll(numParts, [&](const size_t p) {
+    const size_t begin = (numSketches * p) / numParts;
+    const size_t end = (numSketches * (p + 1)) / numParts;
+    for (size_t i = begin; i < end; ++i) {
+      parts[p]->unionImpl(sketches[i]->getImpl(), lgMaxK);
+    }
+  });
+  // tree: parts[p] absorbs parts[p + stride], keeping the earlier sketches on the left
+  for (size_t stride = 1; stride < numParts; stride *= 2) {
+    const size_t numPairs = (numParts + (2 * stride) - 1) / (2 * stride);
+    runAll(numPairs, [&](const size_t pair) {
+      const size_t left = pair * 2 * stride;
+      if (left + stride < numParts) {
+        parts[left]->unionImpl(parts[left + stride]->gadget->getImpl(), lgMaxK);
+      }
+    });
+  }
+
+  std::exception_ptr error = nullptr;
+  for (const std::exception_ptr& e : errors) {
+    if ((error == nullptr) && (e != nullptr)) { error = e; }
+  }
+  if (error == nullptr) {
+    unionImpl(parts[0]->gadget->getImpl(), lgMaxK);
+  }
+  for (HllUnion* part : parts) {
+    delete part;
+  }
+  if (error != nullptr) {
+    std::rethrow_exception(error);
+  }
+}
+
+void HllUnion::checkHashType(HllSketch& sketch) {
+  if (sketch.getHashType() != hashType) {
+    throw std::invalid_argument("Cannot union sketches built with different hash types");
+  }
 }
 
 void HllUnion::couponUpdate(const int coupon) {
   if (coupon == HllUtil::EMPTY) { return; }
-  HllSketchImpl* result = gadget->hllSketchImpl->couponUpdate(coupon);
-  if (result != gadget->hllSketchImpl) {
-    if (gadget->hllSketchImpl != nullptr) { delete gadget->hllSketchImpl; }
-    gadget->hllSketchImpl = result;
-  }
+  gadget->couponUpdate(coupon);
+}
+
+void HllUnion::couponUpdate(const int coupons[], const int len) {
+  gadget->couponUpdate(coupons, len);
 }
 
 std::ostream& HllUnion::to_string(std::ostream& os, const bool summary,
@@ -69,6 +163,18 @@ double HllUnion::getCompositeEstimate() {
   return gadget->getCompositeEstimate();
 }
 
+double HllUnion::getImprovedEstimate() {
+  return gadget->getImprovedEstimate();
+}
+
+void HllUnion::putValueHistogram(const bool flag) {
+  gadget->putValueHistogram(flag);
+}
+
+bool HllUnion::isValueHistogram() {
+  return gadget->isValueHistogram();
+}
+
 double HllUnion::getLowerBound(const int numStdDev) {
   return gadget->getLowerBound(numStdDev);
 }
@@ -117,19 +223,19 @@ int HllUnion::getMaxSerializationBytes(const int lgK) {
   return HllSketch::getMaxUpdatableSerializationBytes(lgK, TgtHllType::HLL_8);
 }
 
-HllSketchImpl* HllUnion::copyOrDownsampleHll(HllSketchImpl* srcImpl, const int tgtLgK) {
+// The copy is allocated from resource, so a sketch from another resource is merged instead.
+HllSketchImpl* HllUnion::copyOrDownsampleHll(HllSketchImpl* srcImpl, const int tgtLgK,
+                                             std::pmr::memory_resource* resource) {
   assert(srcImpl->getCurMode() == CurMode::HLL);
   HllArray* src = (HllArray*) srcImpl;
   const int srcLgK = src->getLgConfigK();
-  if ((srcLgK <= tgtLgK) && (src->getTgtHllType() == TgtHllType::HLL_8)) {
+  if ((srcLgK <= tgtLgK) && (src->getTgtHllType() == TgtHllType::HLL_8)
+      && (src->getResource() == resource)) {
     return src->copy();
   }
   const int minLgK = ((srcLgK < tgtLgK) ? srcLgK : tgtLgK);
-  HllArray* tgtHllArr = HllArray::newHll(minLgK, TgtHllType::HLL_8);
-  std::unique_ptr<PairIterator> srcItr = src->getIterator();
-  while (srcItr->nextValid()) {
-    tgtHllArr->couponUpdate(srcItr->getPair());
-  }
+  HllArray* tgtHllArr = HllArray::newHll(minLgK, TgtHllType::HLL_8, resource);
+  mergeRegisters(src, tgtHllArr);
   //both of these are required for isomorphism
   tgtHllArr->putHipAccum(src->getHipAccum());
   tgtHllArr->putOutOfOrderFlag(src->isOutOfOrderFlag());
@@ -137,6 +243,54 @@ HllSketchImpl* HllUnion::copyOrDownsampleHll(HllSketchImpl* srcImpl, const int t
   return tgtHllArr;
 }
 
+// A target slot takes the max of the source slots that share its low tgtLgK bits, so a
+// larger source is folded in as 2^(srcLgK - tgtLgK) target-sized strips.
+void HllUnion::mergeRegisters(HllArray* src, HllArray* tgt) {
+  assert(tgt->getTgtHllType() == TgtHllType::HLL_8);
+  assert(src->getLgConfigK() >= tgt->getLgConfigK());
+  const int tgtK = 1 << tgt->getLgConfigK();
+  const int numStrips = 1 << (src->getLgConfigK() - tgt->getLgConfigK());
+  if (src->getTgtHllType() == TgtHllType::HLL_8) {
+    for (int i = 0; i < numStrips; ++i) {
+      RegisterScan::maxInto(tgt->hllByteArr, src->hllByteArr + (i * tgtK), tgtK);
+    }
+  } else { // HLL_4
+    // read as it is, without settle(), which would write to the source
+    Hll4Array* src4 = (Hll4Array*) src;
+    const int tgtKmask = tgtK - 1;
+    if (src4->blockCurMin == nullptr) {
+      const int stripBytes = tgtK >> 1; // tgtK is at least 16
+      for (int i = 0; i < numStrips; ++i) {
+        RegisterScan::maxNibblesInto(tgt->hllByteArr, src4->hllByteArr + (i * stripBytes),
+                                     stripBytes, src4->getCurMin());
+      }
+    } else {
+      // each block is relative to its own curMin, and a block lies within one strip or
+      // spans whole strips
+      const int lgPieceSlots = std::min(src4->lgSlotsPerBlock, tgt->getLgConfigK());
+      const int pieceSlots = 1 << lgPieceSlots;
+      const int numSrcSlots = 1 << src->getLgConfigK();
+      for (int slotNo = 0; slotNo < numSrcSlots; slotNo += pieceSlots) {
+        RegisterScan::maxNibblesInto(tgt->hllByteArr + (slotNo & tgtKmask),
+                                     src4->hllByteArr + (slotNo >> 1), pieceSlots >> 1,
+                                     src4->blockCurMin[slotNo >> src4->lgSlotsPerBlock]);
+      }
+    }
+    // the exceptions skipped above, which hold actual values even when unsettled
+    AuxHashMap* auxHashMap = src4->auxHashMap;
+    if (auxHashMap != nullptr) {
+      uint8_t* tgtBytes = tgt->hllByteArr;
+      auxHashMap->forEachEntry([tgtKmask, tgtBytes](const int key, const int value) {
+        const int slotNo = key & tgtKmask;
+        if (value > tgtBytes[slotNo]) {
+          tgtBytes[slotNo] = value;
+        }
+      });
+    }
+  }
+  tgt->rebuildKxQ();
+}
+
 inline HllSketchImpl* HllUnion::leakFreeCouponUpdate(HllSketchImpl* impl, const int coupon) {
   HllSketchImpl* result = impl->couponUpdate(coupon);
   if (result != impl) {
@@ -145,15 +299,22 @@ inline HllSketchImpl* HllUnion::leakFreeCouponUpdate(HllSketchImpl* impl, const
   return result;
 }
 
+HllSketchImpl* HllUnion::leakFreeCouponsUpdate(HllSketchImpl* impl, CouponList* src) {
+  src->forEachCoupon([&impl](const int coupon) {
+    impl = leakFreeCouponUpdate(impl, coupon); //assignment required
+  });
+  return impl;
+}
+
 void HllUnion::unionImpl(HllSketchImpl* incomingImpl, const int lgMaxK) {
-  assert(gadget->hllSketchImpl->getTgtHllType() == TgtHllType::HLL_8);
+  assert(gadget->getImpl()->getTgtHllType() == TgtHllType::HLL_8);
   HllSketchImpl* srcImpl = incomingImpl; //default
-  HllSketchImpl* dstImpl = gadget->hllSketchImpl; //default
+  HllSketchImpl* dstImpl = gadget->getImpl(); //default
   if ((incomingImpl == nullptr) || incomingImpl->isEmpty()) {
-    return; // gadget->hllSketchImpl;
+    return; // gadget->getImpl();
   }
 
-  const int hi2bits = (gadget->hllSketchImpl->isEmpty()) ? 3 : gadget->hllSketchImpl->getCurMode();
+  const int hi2bits = (gadget->getImpl()->isEmpty()) ? 3 : gadget->getImpl()->getCurMode();
   const int lo2bits = incomingImpl->getCurMode();
 
   // TODO: track when we need to free the old gadget
@@ -162,10 +323,7 @@ void HllUnion::unionImpl(HllSketchImpl* incomingImpl, const int lgMaxK) {
   //System.out.println("SW: " + sw);
   switch (sw) {
     case 0: { //src: LIST, gadget: LIST
-      std::unique_ptr<PairIterator> srcItr = srcImpl->getIterator(); //LIST
-      while (srcItr->nextValid()) {
-        dstImpl = leakFreeCouponUpdate(dstImpl, srcItr->getPair()); //assignment required
-      }
+      dstImpl = leakFreeCouponsUpdate(dstImpl, (CouponList*) srcImpl);
       //whichever is True wins:
       dstImpl->putOutOfOrderFlag(dstImpl->isOutOfOrderFlag() | srcImpl->isOutOfOrderFlag());
       // gadget: cleanly updated as needed
@@ -173,10 +331,7 @@ void HllUnion::unionImpl(HllSketchImpl* incomingImpl, const int lgMaxK) {
     }
     case 1: { //src: SET, gadget: LIST
       //consider a swap here
-      std::unique_ptr<PairIterator> srcItr = srcImpl->getIterator(); //SET
-      while (srcItr->nextValid()) {
-        dstImpl = leakFreeCouponUpdate(dstImpl, srcItr->getPair()); //assignment required
-      }
+      dstImpl = leakFreeCouponsUpdate(dstImpl, (CouponList*) srcImpl);
       dstImpl->putOutOfOrderFlag(true); //SET oooFlag is always true
       // gadget: cleanly updated as needed
       break;
@@ -184,32 +339,23 @@ void HllUnion::unionImpl(HllSketchImpl* incomingImpl, const int lgMaxK) {
     case 2: { //src: HLL, gadget: LIST
       //swap so that src is gadget-LIST, tgt is HLL
       //use lgMaxK because LIST has effective K of 2^26
-      srcImpl = gadget->hllSketchImpl;
-      dstImpl = copyOrDownsampleHll(incomingImpl, lgMaxK);
-      std::unique_ptr<PairIterator> srcItr = srcImpl->getIterator();
-      while (srcItr->nextValid()) {
-        dstImpl = leakFreeCouponUpdate(dstImpl, srcItr->getPair()); //assignment required
-      }
+      srcImpl = gadget->getImpl();
+      dstImpl = copyOrDownsampleHll(incomingImpl, lgMaxK, gadget->getResource());
+      dstImpl = leakFreeCouponsUpdate(dstImpl, (CouponList*) srcImpl);
       //whichever is True wins:
       dstImpl->putOutOfOrderFlag(srcImpl->isOutOfOrderFlag() | dstImpl->isOutOfOrderFlag());
       // gadget: swapped, replacing with new impl
-      delete gadget->hllSketchImpl;
+      delete gadget->getImpl();
       break;
     }
     case 4: { //src: LIST, gadget: SET
-      std::unique_ptr<PairIterator> srcItr = srcImpl->getIterator(); //LIST
-      while (srcItr->nextValid()) {
-        dstImpl = leakFreeCouponUpdate(dstImpl, srcItr->getPair()); //assignment required
-      }
+      dstImpl = leakFreeCouponsUpdate(dstImpl, (CouponList*) srcImpl);
       dstImpl->putOutOfOrderFlag(true); //SET oooFlag is always true
       // gadget: cleanly updated as needed
       break;
     }
     case 5: { //src: SET, gadget: SET
-      std::unique_ptr<PairIterator> srcItr = srcImpl->getIterator(); //SET
-      while (srcItr->nextValid()) {
-        dstImpl = leakFreeCouponUpdate(dstImpl, srcItr->getPair()); //assignment required
-      }
+      dstImpl = leakFreeCouponsUpdate(dstImpl, (CouponList*) srcImpl);
       dstImpl->putOutOfOrderFlag(true); //SET oooFlag is always true
       // gadget: cleanly updated as needed
       break;
@@ -217,39 +363,30 @@ void HllUnion::unionImpl(HllSketchImpl* incomingImpl, const int lgMaxK) {
     case 6: { //src: HLL, gadget: SET
       //swap so that src is gadget-SET, tgt is HLL
       //use lgMaxK because LIST has effective K of 2^26
-      srcImpl = gadget->hllSketchImpl;
-      dstImpl = copyOrDownsampleHll(incomingImpl, lgMaxK);
-      std::unique_ptr<PairIterator> srcItr = srcImpl->getIterator(); //LIST
+      srcImpl = gadget->getImpl();
+      dstImpl = copyOrDownsampleHll(incomingImpl, lgMaxK, gadget->getResource());
       assert(dstImpl->getCurMode() == HLL);
-      while (srcItr->nextValid()) {
-        dstImpl = leakFreeCouponUpdate(dstImpl, srcItr->getPair()); //assignment required
-      }
+      dstImpl = leakFreeCouponsUpdate(dstImpl, (CouponList*) srcImpl);
       dstImpl->putOutOfOrderFlag(true); //merging SET into non-empty HLL -> true
       // gadget: swapped, replacing with new impl
-      delete gadget->hllSketchImpl;
+      delete gadget->getImpl();
       break;
     }
     case 8: { //src: LIST, gadget: HLL
       assert(dstImpl->getCurMode() == HLL);
-      std::unique_ptr<PairIterator> srcItr = srcImpl->getIterator(); //LIST
-      while (srcItr->nextValid()) {
-        dstImpl = leakFreeCouponUpdate(dstImpl, srcItr->getPair()); //assignment required
-      }
+      dstImpl = leakFreeCouponsUpdate(dstImpl, (CouponList*) srcImpl);
       //whichever is True wins:
       dstImpl->putOutOfOrderFlag(dstImpl->isOutOfOrderFlag() | srcImpl->isOutOfOrderFlag());
       // gadget: should remain unchanged
-      assert(dstImpl == gadget->hllSketchImpl); // should not have changed from HLL
+      assert(dstImpl == gadget->getImpl()); // should not have changed from HLL
       break;
     }
     case 9: { //src: SET, gadget: HLL
       assert(dstImpl->getCurMode() == HLL);
-      std::unique_ptr<PairIterator> srcItr = srcImpl->getIterator(); //SET
-      while (srcItr->nextValid()) {
-        dstImpl = leakFreeCouponUpdate(dstImpl, srcItr->getPair()); //assignment required
-      }
+      dstImpl = leakFreeCouponsUpdate(dstImpl, (CouponList*) srcImpl);
       dstImpl->putOutOfOrderFlag(true); //merging SET into existing HLL -> true
       // gadget: should remain unchanged
-      assert(dstImpl == gadget->hllSketchImpl); // should not have changed from HLL
+      assert(dstImpl == gadget->getImpl()); // should not have changed from HLL
       break;
     }
     case 10: { //src: HLL, gadget: HLL
@@ -257,46 +394,39 @@ void HllUnion::unionImpl(HllSketchImpl* incomingImpl, const int lgMaxK) {
       const int dstLgK = dstImpl->getLgConfigK();
       const int minLgK = ((srcLgK < dstLgK) ? srcLgK : dstLgK);
       if ((srcLgK < dstLgK) || (dstImpl->getTgtHllType() != HLL_8)) {
-        dstImpl = copyOrDownsampleHll(dstImpl, minLgK);
+        dstImpl = copyOrDownsampleHll(dstImpl, minLgK, gadget->getResource());
         // always replaces gadget
-        delete gadget->hllSketchImpl;
-      }
-      std::unique_ptr<PairIterator> srcItr = srcImpl->getIterator(); //HLL
-      while (srcItr->nextValid()) {
-        dstImpl = leakFreeCouponUpdate(dstImpl, srcItr->getPair()); //assignment required
+        delete gadget->getImpl();
       }
+      // src is at least as big as the gadget now, so fold it straight into the gadget.
+      // The gadget's HIP is not updated, it is discarded anyway.
+      mergeRegisters((HllArray*) srcImpl, (HllArray*) dstImpl);
       dstImpl->putOutOfOrderFlag(true); //union of two HLL modes is always true
       // gadget: replaced if copied/downampled, otherwise should be unchanged
       break;
     }
     case 12: { //src: LIST, gadget: empty
-      std::unique_ptr<PairIterator> srcItr = srcImpl->getIterator(); //LIST
-      while (srcItr->nextValid()) {
-        dstImpl = leakFreeCouponUpdate(dstImpl, srcItr->getPair()); //assignment required
-      }
+      dstImpl = leakFreeCouponsUpdate(dstImpl, (CouponList*) srcImpl);
       dstImpl->putOutOfOrderFlag(srcImpl->isOutOfOrderFlag()); //whatever source is
       // gadget: cleanly updated as needed
       break;
     }
     case 13: { //src: SET, gadget: empty
-      std::unique_ptr<PairIterator> srcItr = srcImpl->getIterator(); //SET
-      while (srcItr->nextValid()) {
-        dstImpl = leakFreeCouponUpdate(dstImpl, srcItr->getPair()); //assignment required
-      }
+      dstImpl = leakFreeCouponsUpdate(dstImpl, (CouponList*) srcImpl);
       dstImpl->putOutOfOrderFlag(true); //SET oooFlag is always true
       // gadget: cleanly updated as needed
       break;
     }
     case 14: { //src: HLL, gadget: empty
-      dstImpl = copyOrDownsampleHll(srcImpl, lgMaxK);
+      dstImpl = copyOrDownsampleHll(srcImpl, lgMaxK, gadget->getResource());
       dstImpl->putOutOfOrderFlag(srcImpl->isOutOfOrderFlag()); //whatever source is.
       // gadget: always replaced with copied/downsampled sketch
-      delete gadget->hllSketchImpl;
+      delete gadget->getImpl();
       break;
     }
   }
   
-  gadget->hllSketchImpl = dstImpl;
+  gadget->putImpl(dstImpl);
 }
 
 }
@@ -3,11 +3,18 @@
  * Apache License 2.0. See LICENSE file at the project root for terms.
  */
 
+#pragma once
+
 #include "BaseHllSketch.hpp"
 #include "HllSketch.hpp"
+#include "StaticHllSketch.hpp"
+
+#include <memory>
 
 namespace datasketches {
 
+class CouponList;
+
 /**
  * This performs union operations for HLL sketches. This union operator is configured with a
  * <i>lgMaxK</i> instead of the normal <i>lgConfigK</i>.
@@ -35,12 +42,18 @@ namespace datasketches {
 class HllUnion : public BaseHllSketch {
   public:
     explicit HllUnion(const int lgMaxK);
+    explicit HllUnion(const int lgMaxK, const HashType hashType);
+    // the union's state and the sketches from getResult() are allocated from resource
+    explicit HllUnion(const int lgMaxK, const HashType hashType,
+                      std::pmr::memory_resource* resource);
     explicit HllUnion(HllSketch& sketch);
 
     virtual ~HllUnion();
 
     double getEstimate();
     double getCompositeEstimate();
+    // see HllSketch::getImprovedEstimate()
+    double getImprovedEstimate();
     double getLowerBound(const int numStdDev);
     double getUpperBound(const int numStdDev);
 
@@ -54,6 +67,10 @@ class HllUnion : public BaseHllSketch {
     bool isEmpty();
     bool isOutOfOrderFlag();
 
+    // see HllSketch::putValueHistogram(); results from getResult() inherit the setting
+    void putValueHistogram(const bool flag);
+    bool isValueHistogram();
+
     void reset();
 
     HllSketch* getResult();
@@ -62,14 +79,42 @@ class HllUnion : public BaseHllSketch {
     std::ostream& to_string(std::ostream& os, const bool summary,
                             const bool detail, const bool auxDetail, const bool all);
 
+    // throws std::invalid_argument if the sketch was built with a different HashType
     void update(HllSketch& sketch);
     void update(HllSketch* sketch);
+    template<int LgK, TgtHllType TgtType>
+    void update(StaticHllSketch<LgK, TgtType>& sketch);
+
+    /**
+     * Unions many sketches using several threads. The sketches are split into contiguous
+     * ranges, each thread unions its range into a private HLL_8 gadget, and the partial
+     * gadgets are combined pairwise in a tree whose left side always holds the earlier
+     * sketches. The result is identical to calling update() on each sketch in order.
+     *
+     * <p>HLL merges leave the HIP accumulator alone, so the tree is only used when the union
+     * and all non-empty sketches are in HLL mode. Otherwise a LIST or SET merge would feed
+     * coupons into a HIP accumulator that depends on merge order, and the sketches are
+     * unioned one at a time on the calling thread instead.
+     *
+     * <p>The private gadgets come from std::pmr::new_delete_resource(), so the union's own
+     * resource, and those of the sketches, are only used on the calling thread and need not
+     * be thread safe.
+     *
+     * @param sketches the sketches to union, none of which are written to, so a sketch may
+     * appear more than once
+     * @param numSketches the number of sketches
+     * @param numThreads the maximum number of threads to use, including the calling one
+     * @throws std::invalid_argument if any sketch was built with a different HashType, in
+     * which case the union is left unchanged
+     */
+    void update(HllSketch* const sketches[], const size_t numSketches, const int numThreads);
 
     static int getMaxSerializationBytes(const int lgK);
 
 
   protected:
     void couponUpdate(const int coupon);
+    void couponUpdate(const int coupons[], const int len);
 
    /**
     * Union the given source and destination sketches. This static method examines the state of
@@ -86,13 +131,31 @@ class HllUnion : public BaseHllSketch {
     */
     void unionImpl(HllSketchImpl* incomingImpl, const int lgMaxK);
 
-    static HllSketchImpl* copyOrDownsampleHll(HllSketchImpl* srcImpl, const int tgtLgK);
+    void checkHashType(HllSketch& sketch);
+
+    static HllSketchImpl* copyOrDownsampleHll(HllSketchImpl* srcImpl, const int tgtLgK,
+                                              std::pmr::memory_resource* resource);
+
+    // Merges the registers of an HLL_4 or HLL_8 array into an HLL_8 array with the same or a
+    // smaller lgConfigK, downsampling as needed, without iterating slot by slot. Then rebuilds
+    // the target's KxQ registers. Does not touch the target's HIP accumulator or
+    // out-of-order flag.
+    static void mergeRegisters(HllArray* src, HllArray* tgt);
 
     // calls couponUpdate on sketch, freeing the old sketch upon changes in CurMode
     static HllSketchImpl* leakFreeCouponUpdate(HllSketchImpl* impl, const int coupon);
 
+    // leakFreeCouponUpdate for every coupon of a LIST or SET, returning the final impl
+    static HllSketchImpl* leakFreeCouponsUpdate(HllSketchImpl* impl, CouponList* src);
+
     const int lgMaxK;
     HllSketch* gadget;
 };
 
+template<int LgK, TgtHllType TgtType>
+void HllUnion::update(StaticHllSketch<LgK, TgtType>& sketch) {
+  std::unique_ptr<HllSketch> copy(sketch.copyAsHllSketch());
+  update(*copy);
+}
+
 }
@@ -7,6 +7,7 @@
 
 #include <cassert>
 #include <cmath>
+#include <cstdint>
 #include <exception>
 #include <string>
 #include <sstream>
@@ -35,6 +36,7 @@ public:
   static const int KEY_MASK_26 = (1 << KEY_BITS_26) - 1;
   static const int VAL_MASK_6 = (1 << VAL_BITS_6) - 1;
   static const int EMPTY = 0;
+  static const uint64_t DEFAULT_UPDATE_SEED = 9001L;
   static const int MIN_LOG_K = 4;
   static const int MAX_LOG_K = 21;
 
@@ -65,6 +67,7 @@ public:
   static int getLow26(const int coupon);
   static int getValue(const int coupon);
   static double invPow2(const int e);
+  static double canonicalize(const double datum);
 };
 
 inline int HllUtil::checkLgK(const int lgK) {
@@ -88,13 +91,20 @@ inline void HllUtil::checkNumStdDev(const int numStdDev) {
   }
 }
 
+// Values reach 63, which sets the sign bit, so shift as unsigned (Java's >>>)
 inline int HllUtil::pair(const int slotNo, const int value) {
-  return (value << HllUtil::KEY_BITS_26) | (slotNo & HllUtil::KEY_MASK_26);
+  return (int) (((unsigned) value << HllUtil::KEY_BITS_26) | (slotNo & HllUtil::KEY_MASK_26));
 }
 
 inline int HllUtil::getLow26(const int coupon) { return coupon & HllUtil::KEY_MASK_26; }
 
-inline int HllUtil::getValue(const int coupon) { return coupon >> HllUtil::KEY_BITS_26; }
+inline int HllUtil::getValue(const int coupon) { return (int) ((unsigned) coupon >> HllUtil::KEY_BITS_26); }
+
+inline double HllUtil::canonicalize(const double datum) {
+  double d = ((datum == 0.0) ? 0.0 : datum); // canonicalize -0.0, 0.0
+  d = (std::isnan(d) ? NAN : d); // canonicalize NaN, although portability to Java not guaranteed
+  return d;
+}
 
 inline double HllUtil::invPow2(const int e) {
   union {
@@ -31,6 +31,12 @@ typedef unsigned __int64 uint64_t;
 
 void MurmurHash3_x64_128 ( const void * key, int len, uint64_t seed, void * out );
 
+// Hashes n 8-byte keys. The result for keys[i] is written to out[2*i] and
+// out[2*i+1] and is identical to MurmurHash3_x64_128(&keys[i], 8, seed, ...).
+// Uses 8 lanes with AVX-512 or 4 lanes with AVX2 when the CPU has them.
+
+void MurmurHash3_x64_128_keys8 ( const uint64_t * keys, int n, uint64_t seed, uint64_t * out );
+
 //-----------------------------------------------------------------------------
 
 #ifdef __cplusplus
@@ -0,0 +1,104 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+namespace datasketches {
+
+/**
+ * MurmurHash3_x64_128 specialized for inputs whose length is known at compile time.
+ * Each function returns exactly what MurmurHash3_x64_128(key, len, seed, out) would,
+ * but without the block loop and tail switch. Like murmur3.cpp, these assume a
+ * little-endian host.
+ */
+class MurmurHash3Fixed {
+public:
+  static void hash4(const void* key, const uint64_t seed, uint64_t* out);
+  static void hash8(const void* key, const uint64_t seed, uint64_t* out);
+  static void hash16(const void* key, const uint64_t seed, uint64_t* out);
+
+  static const uint64_t C1 = 0x87c37b91114253d5ULL;
+  static const uint64_t C2 = 0x4cf5ad432745937fULL;
+
+private:
+  static uint64_t rotl64(const uint64_t x, const int r);
+  static uint64_t fmix64(uint64_t k);
+  static uint64_t mixK1(uint64_t k1);
+  static void finalize(uint64_t h1, uint64_t h2, const uint64_t len, uint64_t* out);
+};
+
+inline uint64_t MurmurHash3Fixed::rotl64(const uint64_t x, const int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t MurmurHash3Fixed::fmix64(uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+inline uint64_t MurmurHash3Fixed::mixK1(uint64_t k1) {
+  k1 *= C1;
+  k1 = rotl64(k1, 31);
+  k1 *= C2;
+  return k1;
+}
+
+inline void MurmurHash3Fixed::finalize(uint64_t h1, uint64_t h2, const uint64_t len, uint64_t* out) {
+  h1 ^= len;
+  h2 ^= len;
+  h1 += h2;
+  h2 += h1;
+  h1 = fmix64(h1);
+  h2 = fmix64(h2);
+  h1 += h2;
+  h2 += h1;
+  out[0] = h1;
+  out[1] = h2;
+}
+
+// len 4: no blocks, tail case 4 through 1
+inline void MurmurHash3Fixed::hash4(const void* key, const uint64_t seed, uint64_t* out) {
+  uint32_t k;
+  std::memcpy(&k, key, sizeof(k));
+  finalize(seed ^ mixK1(k), seed, 4, out);
+}
+
+// len 8: no blocks, tail case 8 through 1
+inline void MurmurHash3Fixed::hash8(const void* key, const uint64_t seed, uint64_t* out) {
+  uint64_t k;
+  std::memcpy(&k, key, sizeof(k));
+  finalize(seed ^ mixK1(k), seed, 8, out);
+}
+
+// len 16: one block, empty tail
+inline void MurmurHash3Fixed::hash16(const void* key, const uint64_t seed, uint64_t* out) {
+  uint64_t k[2];
+  std::memcpy(k, key, sizeof(k));
+
+  uint64_t h1 = seed ^ mixK1(k[0]);
+  h1 = rotl64(h1, 27);
+  h1 += seed;
+  h1 = h1 * 5 + 0x52dce729;
+
+  uint64_t k2 = k[1];
+  k2 *= C2;
+  k2 = rotl64(k2, 33);
+  k2 *= C1;
+  uint64_t h2 = seed ^ k2;
+  h2 = rotl64(h2, 31);
+  h2 += h1;
+  h2 = h2 * 5 + 0x38495ab5;
+
+  finalize(h1, h2, 16, out);
+}
+
+}
@@ -0,0 +1,245 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#include "RegisterScan.hpp"
+#include "HllUtil.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define REGISTER_SCAN_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+namespace datasketches {
+
+namespace {
+
+// The sums are kept as integers scaled by 2^31 and 2^63.
+void sumScalar(const uint8_t* values, const int len, const int countedValue,
+               uint64_t& sum0, uint64_t& sum1, int& numCounted) {
+  uint64_t s0 = 0;
+  uint64_t s1 = 0;
+  int n = 0;
+  for (int i = 0; i < len; ++i) {
+    const int v = values[i];
+    if (v < 32)      { s0 += 1ULL << (31 - v); }
+    else if (v < 64) { s1 += 1ULL << (63 - v); }
+    n += (v == countedValue);
+  }
+  sum0 = s0;
+  sum1 = s1;
+  numCounted = n;
+}
+
+int minScalar(const uint8_t* values, const int len) {
+  int m = 255;
+  for (int i = 0; i < len; ++i) {
+    m = std::min(m, (int) values[i]);
+  }
+  return m;
+}
+
+void maxIntoScalar(uint8_t* tgt, const uint8_t* src, const int len) {
+  for (int i = 0; i < len; ++i) {
+    tgt[i] = std::max(tgt[i], src[i]);
+  }
+}
+
+void maxNibblesIntoScalar(uint8_t* tgt, const uint8_t* nibbles, const int numBytes,
+                          const int curMin) {
+  for (int i = 0; i < numBytes; ++i) {
+    const int lo = nibbles[i] & HllUtil::loNibbleMask;
+    const int hi = nibbles[i] >> 4;
+    if (lo != HllUtil::AUX_TOKEN) {
+      tgt[2 * i] = (uint8_t) std::max((int) tgt[2 * i], lo + curMin);
+    }
+    if (hi != HllUtil::AUX_TOKEN) {
+      tgt[2 * i + 1] = (uint8_t) std::max((int) tgt[2 * i + 1], hi + curMin);
+    }
+  }
+}
+
+#ifdef REGISTER_SCAN_X86_DISPATCH
+
+// AVX2: 4 values per step, widened to 64-bit lanes so each term is one variable shift.
+// Shift counts of 64 or more (values that do not belong to a sum) produce 0.
+__attribute__((target("avx2")))
+void sumAvx2(const uint8_t* values, const int len, const int countedValue,
+             uint64_t& sum0, uint64_t& sum1, int& numCounted) {
+  const __m256i one = _mm256_set1_epi64x(1);
+  const __m256i c31 = _mm256_set1_epi64x(31);
+  const __m256i c63 = _mm256_set1_epi64x(63);
+  const __m256i counted = _mm256_set1_epi64x(countedValue);
+  __m256i acc0 = _mm256_setzero_si256();
+  __m256i acc1 = _mm256_setzero_si256();
+  __m256i accN = _mm256_setzero_si256();
+  int i = 0;
+  for (; i + 4 <= len; i += 4) {
+    int packed;
+    __builtin_memcpy(&packed, values + i, sizeof(packed));
+    const __m256i v = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(packed));
+    acc0 = _mm256_add_epi64(acc0, _mm256_sllv_epi64(one, _mm256_sub_epi64(c31, v)));
+    const __m256i high = _mm256_cmpgt_epi64(v, c31);
+    acc1 = _mm256_add_epi64(acc1,
+        _mm256_and_si256(high, _mm256_sllv_epi64(one, _mm256_sub_epi64(c63, v))));
+    accN = _mm256_sub_epi64(accN, _mm256_cmpeq_epi64(v, counted));
+  }
+  uint64_t lanes0[4], lanes1[4], lanesN[4];
+  _mm256_storeu_si256((__m256i*) lanes0, acc0);
+  _mm256_storeu_si256((__m256i*) lanes1, acc1);
+  _mm256_storeu_si256((__m256i*) lanesN, accN);
+  uint64_t tail0, tail1;
+  int tailN;
+  sumScalar(values + i, len - i, countedValue, tail0, tail1, tailN);
+  sum0 = lanes0[0] + lanes0[1] + lanes0[2] + lanes0[3] + tail0;
+  sum1 = lanes1[0] + lanes1[1] + lanes1[2] + lanes1[3] + tail1;
+  numCounted = (int) (lanesN[0] + lanesN[1] + lanesN[2] + lanesN[3]) + tailN;
+}
+
+__attribute__((target("avx2")))
+int minAvx2(const uint8_t* values, const int len) {
+  __m256i acc = _mm256_set1_epi8((char) 0xff);
+  int i = 0;
+  for (; i + 32 <= len; i += 32) {
+    acc = _mm256_min_epu8(acc, _mm256_loadu_si256((const __m256i*) (values + i)));
+  }
+  uint8_t lanes[32];
+  _mm256_storeu_si256((__m256i*) lanes, acc);
+  return std::min(minScalar(lanes, 32), minScalar(values + i, len - i));
+}
+
+__attribute__((target("avx2")))
+void maxIntoAvx2(uint8_t* tgt, const uint8_t* src, const int len) {
+  int i = 0;
+  for (; i + 64 <= len; i += 64) {
+    const __m256i a0 = _mm256_loadu_si256((const __m256i*) (tgt + i));
+    const __m256i a1 = _mm256_loadu_si256((const __m256i*) (tgt + i + 32));
+    const __m256i b0 = _mm256_loadu_si256((const __m256i*) (src + i));
+    const __m256i b1 = _mm256_loadu_si256((const __m256i*) (src + i + 32));
+    _mm256_storeu_si256((__m256i*) (tgt + i), _mm256_max_epu8(a0, b0));
+    _mm256_storeu_si256((__m256i*) (tgt + i + 32), _mm256_max_epu8(a1, b1));
+  }
+  maxIntoScalar(tgt + i, src + i, len - i);
+}
+
+// AVX2: 32 packed bytes per step. AUX_TOKEN nibbles become 0, which never raises a value.
+// unpacklo/unpackhi interleave within 128-bit lanes, so the halves are put back in order.
+__attribute__((target("avx2")))
+void maxNibblesIntoAvx2(uint8_t* tgt, const uint8_t* nibbles, const int numBytes,
+                        const int curMin) {
+  const __m256i nibMask = _mm256_set1_epi8(HllUtil::loNibbleMask);
+  const __m256i auxToken = _mm256_set1_epi8(HllUtil::AUX_TOKEN);
+  const __m256i offset = _mm256_set1_epi8((char) curMin);
+  int i = 0;
+  for (; i + 32 <= numBytes; i += 32) {
+    const __m256i packed = _mm256_loadu_si256((const __m256i*) (nibbles + i));
+    __m256i lo = _mm256_and_si256(packed, nibMask);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(packed, 4), nibMask);
+    lo = _mm256_andnot_si256(_mm256_cmpeq_epi8(lo, auxToken), _mm256_add_epi8(lo, offset));
+    hi = _mm256_andnot_si256(_mm256_cmpeq_epi8(hi, auxToken), _mm256_add_epi8(hi, offset));
+    const __m256i mixedLo = _mm256_unpacklo_epi8(lo, hi);
+    const __m256i mixedHi = _mm256_unpackhi_epi8(lo, hi);
+    uint8_t* out = tgt + (2 * i);
+    const __m256i out0 = _mm256_permute2x128_si256(mixedLo, mixedHi, 0x20);
+    const __m256i out1 = _mm256_permute2x128_si256(mixedLo, mixedHi, 0x31);
+    _mm256_storeu_si256((__m256i*) out,
+        _mm256_max_epu8(out0, _mm256_loadu_si256((const __m256i*) out)));
+    _mm256_storeu_si256((__m256i*) (out + 32),
+        _mm256_max_epu8(out1, _mm256_loadu_si256((const __m256i*) (out + 32))));
+  }
+  maxNibblesIntoScalar(tgt + (2 * i), nibbles + i, numBytes - i, curMin);
+}
+
+#endif // REGISTER_SCAN_X86_DISPATCH
+
+typedef void (*SumFn)(const uint8_t*, int, int, uint64_t&, uint64_t&, int&);
+typedef int (*MinFn)(const uint8_t*, int);
+typedef void (*MaxIntoFn)(uint8_t*, const uint8_t*, int);
+typedef void (*MaxNibblesIntoFn)(uint8_t*, const uint8_t*, int, int);
+
+bool useAvx2() {
+#ifdef REGISTER_SCAN_X86_DISPATCH
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#else
+  return false;
+#endif
+}
+
+SumFn selectSum() {
+#ifdef REGISTER_SCAN_X86_DISPATCH
+  if (useAvx2()) { return sumAvx2; }
+#endif
+  return sumScalar;
+}
+
+MinFn selectMin() {
+#ifdef REGISTER_SCAN_X86_DISPATCH
+  if (useAvx2()) { return minAvx2; }
+#endif
+  return minScalar;
+}
+
+MaxIntoFn selectMaxInto() {
+#ifdef REGISTER_SCAN_X86_DISPATCH
+  if (useAvx2()) { return maxIntoAvx2; }
+#endif
+  return maxIntoScalar;
+}
+
+MaxNibblesIntoFn selectMaxNibblesInto() {
+#ifdef REGISTER_SCAN_X86_DISPATCH
+  if (useAvx2()) { return maxNibblesIntoAvx2; }
+#endif
+  return maxNibblesIntoScalar;
+}
+
+} // namespace
+
+void RegisterScan::sumInvPow2(const uint8_t* values, const int len, const int countedValue,
+                              double& kxq0, double& kxq1, int& numCounted) {
+  static const SumFn impl = selectSum();
+  uint64_t sum0, sum1;
+  impl(values, len, countedValue, sum0, sum1, numCounted);
+  kxq0 = std::ldexp((double) sum0, -31);
+  kxq1 = std::ldexp((double) sum1, -63);
+}
+
+void RegisterScan::countValues(const uint8_t* values, const int len, int counts[]) {
+  int partial[4][256] = {{0}};
+  int i = 0;
+  for (; i + 4 <= len; i += 4) {
+    ++partial[0][values[i]];
+    ++partial[1][values[i + 1]];
+    ++partial[2][values[i + 2]];
+    ++partial[3][values[i + 3]];
+  }
+  for (; i < len; ++i) {
+    ++partial[0][values[i]];
+  }
+  for (int value = 0; value < 64; ++value) {
+    counts[value] += partial[0][value] + partial[1][value] + partial[2][value] + partial[3][value];
+  }
+}
+
+int RegisterScan::minValue(const uint8_t* values, const int len) {
+  static const MinFn impl = selectMin();
+  return impl(values, len);
+}
+
+void RegisterScan::maxInto(uint8_t* tgt, const uint8_t* src, const int len) {
+  static const MaxIntoFn impl = selectMaxInto();
+  impl(tgt, src, len);
+}
+
+void RegisterScan::maxNibblesInto(uint8_t* tgt, const uint8_t* nibbles, const int numBytes,
+                                  const int curMin) {
+  static const MaxNibblesIntoFn impl = selectMaxNibblesInto();
+  impl(tgt, nibbles, numBytes, curMin);
+}
+
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+namespace datasketches {
+
+/**
+ * Whole-array passes over HLL register values stored one per byte, used to merge arrays
+ * and to rebuild the KxQ registers and curMin bookkeeping after bulk changes to an array.
+ *
+ * <p>kxq0 sums 2^-v over values below 32 and kxq1 over values 32 to 63, so with at most
+ * 2^21 registers each is an integer multiple of 2^-31 or 2^-63 below 2^52. Summing them as
+ * integers is exact, and the result does not depend on summation order: it is bit-identical
+ * to maintaining them one update at a time. Vector kernels are selected at runtime.
+ */
+class RegisterScan {
+  public:
+    /**
+     * @param values register values, one per byte; values above 63 are skipped
+     * @param len the number of values
+     * @param countedValue the value whose occurrences are counted
+     * @param kxq0 set to the sum of 2^-v for values v below 32
+     * @param kxq1 set to the sum of 2^-v for values v from 32 to 63
+     * @param numCounted set to the number of values equal to countedValue
+     */
+    static void sumInvPow2(const uint8_t* values, const int len, const int countedValue,
+                           double& kxq0, double& kxq1, int& numCounted);
+
+    /**
+     * Adds the number of occurrences of each value to counts. Four partial counts are kept
+     * so that runs of equal values do not serialize on one counter; there is no vector kernel.
+     * @param values register values, one per byte; values above 63 are skipped
+     * @param len the number of values
+     * @param counts 64 counts, indexed by value
+     */
+    static void countValues(const uint8_t* values, const int len, int counts[]);
+
+    // Returns the smallest of the given values, or 255 if len is 0.
+    static int minValue(const uint8_t* values, const int len);
+
+    // Sets each of tgt[0, len) to the larger of itself and the matching src value.
+    static void maxInto(uint8_t* tgt, const uint8_t* src, const int len);
+
+    /**
+     * Like maxInto() for the packed HLL_4 nibbles, two per byte with the even slot in the low
+     * nibble, each standing for curMin plus its value. AUX_TOKEN nibbles leave tgt unchanged;
+     * the caller applies the AuxHashMap.
+     * @param tgt one byte per slot, 2 * numBytes slots
+     * @param nibbles the packed nibbles
+     * @param numBytes the length of nibbles
+     * @param curMin the curMin the nibbles are relative to
+     */
+    static void maxNibblesInto(uint8_t* tgt, const uint8_t* nibbles, const int numBytes,
+                               const int curMin);
+};
+
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+
+namespace datasketches {
+
+/**
+ * Base of the classes whose objects and arrays come from a std::pmr::memory_resource, so
+ * the memory of a sketch can be placed in an arena or a NUMA-local pool.
+ *
+ * <p>Objects are created with new (resource) T(..., resource). The resource and the block
+ * size are also recorded in front of the object, which lets a plain delete, through a
+ * pointer of any type in the hierarchy, give the memory back to the resource it came from.
+ * Because this class declares its own operator new, new T(...) without a resource does not
+ * compile.
+ *
+ * <p>The resource must outlive every object and array allocated from it.
+ */
+class ResourceAllocated {
+  public:
+    static void* operator new(std::size_t size, std::pmr::memory_resource* resource) {
+      const std::size_t blockBytes = size + HEADER_BYTES;
+      void* block = resource->allocate(blockBytes, alignof(std::max_align_t));
+      *static_cast<Header*>(block) = {resource, blockBytes};
+      return static_cast<char*>(block) + HEADER_BYTES;
+    }
+
+    static void operator delete(void* ptr) {
+      void* block = static_cast<char*>(ptr) - HEADER_BYTES;
+      const Header header = *static_cast<Header*>(block);
+      header.resource->deallocate(block, header.blockBytes, alignof(std::max_align_t));
+    }
+
+    // used only if a constructor throws
+    static void operator delete(void* ptr, std::pmr::memory_resource*) {
+      operator delete(ptr);
+    }
+
+    std::pmr::memory_resource* getResource() const { return resource; }
+
+  protected:
+    explicit ResourceAllocated(std::pmr::memory_resource* resource) : resource(resource) {}
+
+    // uninitialized storage for len values of T
+    template<typename T> T* newArray(const int len) {
+      return static_cast<T*>(resource->allocate(len * sizeof(T), alignof(T)));
+    }
+
+    template<typename T> void deleteArray(T* arr, const int len) {
+      if (arr != nullptr) {
+        resource->deallocate(arr, len * sizeof(T), alignof(T));
+      }
+    }
+
+    std::pmr::memory_resource* const resource;
+
+  private:
+    struct Header {
+      std::pmr::memory_resource* resource;
+      std::size_t blockBytes;
+    };
+    // keeps the object as aligned as the block
+    static const std::size_t HEADER_BYTES =
+        ((sizeof(Header) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t))
+        * alignof(std::max_align_t);
+};
+
+}
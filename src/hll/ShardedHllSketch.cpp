@@ -0,0 +1,278 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#include "ShardedHllSketch.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <unordered_set>
+
+namespace datasketches {
+
+// On its own cache line, so shards of different threads never share one.
+struct alignas(64) ShardedHllSketch::Shard {
+  Shard(const int lgConfigK, const TgtHllType tgtHllType, const HashType hashType)
+    : sketch(new HllSketch(lgConfigK, tgtHllType, hashType)),
+      dirty(false) {}
+  ~Shard() { delete sketch; }
+
+  std::mutex mutex;
+  HllSketch* sketch;
+  bool dirty; // updated since the last merge
+};
+
+namespace {
+
+std::atomic<uint64_t> nextSketchId(1);
+
+// ids of the sketches that still exist, so threads can drop entries for destroyed ones
+std::mutex liveIdsMutex;
+std::unordered_set<uint64_t>& liveIds() {
+  static std::unordered_set<uint64_t> ids;
+  return ids;
+}
+
+struct LocalShard {
+  uint64_t sketchId;
+  void* shard;
+};
+
+// the calling thread's shard of each sketch it has updated
+thread_local std::vector<LocalShard> localShards;
+
+}
+
+ShardedHllSketch::ShardedHllSketch(const int lgConfigK, const TgtHllType tgtHllType,
+                                   const int mergeIntervalMillis)
+  : ShardedHllSketch(lgConfigK, tgtHllType, mergeIntervalMillis, HashType::MURMUR3) {}
+
+ShardedHllSketch::ShardedHllSketch(const int lgConfigK, const TgtHllType tgtHllType,
+                                   const int mergeIntervalMillis, const HashType hashType)
+  : BaseHllSketch(hashType),
+    lgConfigK(HllUtil::checkLgK(lgConfigK)),
+    tgtHllType(tgtHllType),
+    mergeIntervalMillis(mergeIntervalMillis),
+    id(nextSketchId.fetch_add(1)),
+    hllUnion(new HllUnion(lgConfigK, hashType)),
+    snapshot(new HllSketch(lgConfigK, TgtHllType::HLL_8, hashType)),
+    stopping(false) {
+  if (mergeIntervalMillis <= 0) {
+    delete hllUnion;
+    delete snapshot;
+    throw std::invalid_argument("mergeIntervalMillis must be positive");
+  }
+  {
+    std::lock_guard<std::mutex> lock(liveIdsMutex);
+    liveIds().insert(id);
+  }
+  merger = std::thread(&ShardedHllSketch::mergeLoop, this);
+}
+
+ShardedHllSketch::~ShardedHllSketch() {
+  {
+    std::lock_guard<std::mutex> lock(stopMutex);
+    stopping = true;
+  }
+  stopCondition.notify_all();
+  merger.join();
+  {
+    std::lock_guard<std::mutex> lock(liveIdsMutex);
+    liveIds().erase(id);
+  }
+  for (Shard* shard : shards) {
+    delete shard;
+  }
+  delete hllUnion;
+  delete snapshot;
+}
+
+ShardedHllSketch::Shard* ShardedHllSketch::localShard() {
+  for (const LocalShard& entry : localShards) {
+    if (entry.sketchId == id) {
+      return (Shard*) entry.shard;
+    }
+  }
+
+  // first update from this thread
+  {
+    std::lock_guard<std::mutex> lock(liveIdsMutex);
+    const std::unordered_set<uint64_t>& ids = liveIds();
+    localShards.erase(std::remove_if(localShards.begin(), localShards.end(),
+                                     [&ids](const LocalShard& entry) {
+                                       return ids.count(entry.sketchId) == 0;
+                                     }),
+                      localShards.end());
+  }
+  Shard* shard = new Shard(lgConfigK, tgtHllType, hashType);
+  {
+    std::lock_guard<std::mutex> lock(shardsMutex);
+    shards.push_back(shard);
+  }
+  localShards.push_back({id, shard});
+  return shard;
+}
+
+void ShardedHllSketch::couponUpdate(int coupon) {
+  if (coupon == HllUtil::EMPTY) { return; }
+  Shard* shard = localShard();
+  std::lock_guard<std::mutex> lock(shard->mutex);
+  shard->sketch->couponUpdate(coupon);
+  shard->dirty = true;
+}
+
+void ShardedHllSketch::couponUpdate(const int coupons[], const int len) {
+  Shard* shard = localShard();
+  std::lock_guard<std::mutex> lock(shard->mutex);
+  shard->sketch->couponUpdate(coupons, len);
+  shard->dirty = true;
+}
+
+void ShardedHllSketch::mergeLoop() {
+  std::unique_lock<std::mutex> lock(stopMutex);
+  while (!stopping) {
+    stopCondition.wait_for(lock, std::chrono::milliseconds(mergeIntervalMillis),
+                           [this]() { return stopping; });
+    if (stopping) { break; }
+    lock.unlock();
+    {
+      std::lock_guard<std::mutex> merging(mergeMutex);
+      mergeShards();
+    }
+    lock.lock();
+  }
+}
+
+// Each dirty shard is swapped for an empty sketch under its lock, then merged without it.
+void ShardedHllSketch::mergeShards() {
+  std::vector<Shard*> current;
+  {
+    std::lock_guard<std::mutex> lock(shardsMutex);
+    current = shards;
+  }
+  HllSketch* empty = nullptr;
+  for (Shard* shard : current) {
+    if (empty == nullptr) {
+      empty = new HllSketch(lgConfigK, tgtHllType, hashType);
+    }
+    HllSketch* taken = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      if (shard->dirty) {
+        taken = shard->sketch;
+        shard->sketch = empty;
+        shard->dirty = false;
+        empty = nullptr;
+      }
+    }
+    if (taken != nullptr) {
+      hllUnion->update(*taken);
+      delete taken;
+    }
+  }
+  delete empty;
+
+  HllSketch* merged = hllUnion->getResult(TgtHllType::HLL_8);
+  {
+    std::lock_guard<std::mutex> lock(snapshotMutex);
+    std::swap(snapshot, merged);
+  }
+  delete merged;
+}
+
+void ShardedHllSketch::flush() {
+  std::lock_guard<std::mutex> merging(mergeMutex);
+  mergeShards();
+}
+
+void ShardedHllSketch::reset() {
+  std::lock_guard<std::mutex> merging(mergeMutex);
+  {
+    std::lock_guard<std::mutex> lock(shardsMutex);
+    for (Shard* shard : shards) {
+      std::lock_guard<std::mutex> shardLock(shard->mutex);
+      shard->sketch->reset();
+      shard->dirty = false;
+    }
+  }
+  hllUnion->reset();
+  std::lock_guard<std::mutex> lock(snapshotMutex);
+  snapshot->reset();
+}
+
+HllSketch* ShardedHllSketch::getResult(const TgtHllType tgtHllType) {
+  std::lock_guard<std::mutex> lock(snapshotMutex);
+  return snapshot->copyAs(tgtHllType);
+}
+
+double ShardedHllSketch::getEstimate() {
+  std::lock_guard<std::mutex> lock(snapshotMutex);
+  return snapshot->getEstimate();
+}
+
+double ShardedHllSketch::getCompositeEstimate() {
+  std::lock_guard<std::mutex> lock(snapshotMutex);
+  return snapshot->getCompositeEstimate();
+}
+
+double ShardedHllSketch::getLowerBound(const int numStdDev) {
+  std::lock_guard<std::mutex> lock(snapshotMutex);
+  return snapshot->getLowerBound(numStdDev);
+}
+
+double ShardedHllSketch::getUpperBound(const int numStdDev) {
+  std::lock_guard<std::mutex> lock(snapshotMutex);
+  return snapshot->getUpperBound(numStdDev);
+}
+
+int ShardedHllSketch::getCompactSerializationBytes() {
+  std::lock_guard<std::mutex> lock(snapshotMutex);
+  return snapshot->getCompactSerializationBytes();
+}
+
+int ShardedHllSketch::getUpdatableSerializationBytes() {
+  std::lock_guard<std::mutex> lock(snapshotMutex);
+  return snapshot->getUpdatableSerializationBytes();
+}
+
+int ShardedHllSketch::getLgConfigK() {
+  return lgConfigK;
+}
+
+int ShardedHllSketch::getMergeIntervalMillis() {
+  return mergeIntervalMillis;
+}
+
+CurMode ShardedHllSketch::getCurMode() {
+  std::lock_guard<std::mutex> lock(snapshotMutex);
+  return snapshot->getCurMode();
+}
+
+TgtHllType ShardedHllSketch::getTgtHllType() {
+  return tgtHllType;
+}
+
+bool ShardedHllSketch::isCompact() {
+  return false;
+}
+
+bool ShardedHllSketch::isEmpty() {
+  std::lock_guard<std::mutex> lock(snapshotMutex);
+  return snapshot->isEmpty();
+}
+
+bool ShardedHllSketch::isOutOfOrderFlag() {
+  std::lock_guard<std::mutex> lock(snapshotMutex);
+  return snapshot->isOutOfOrderFlag();
+}
+
+std::ostream& ShardedHllSketch::to_string(std::ostream& os, const bool summary,
+                                          const bool detail, const bool auxDetail,
+                                          const bool all) {
+  std::lock_guard<std::mutex> lock(snapshotMutex);
+  return snapshot->to_string(os, summary, detail, auxDetail, all);
+}
+
+}
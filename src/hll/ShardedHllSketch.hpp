@@ -0,0 +1,106 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#pragma once
+
+#include "BaseHllSketch.hpp"
+#include "HllSketch.hpp"
+#include "HllUnion.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace datasketches {
+
+/**
+ * A sketch for very high ingest rates from many threads. Each updating thread gets its own
+ * private HllSketch (a shard), so updates share no cache lines. A background thread merges
+ * the shards into an HllUnion every mergeIntervalMillis and publishes the result as a
+ * snapshot.
+ *
+ * <p>Estimates, bounds and getResult() read the latest snapshot. An update that returned
+ * before a merge started is in the snapshot that merge publishes, so a snapshot is never
+ * more than one merge interval plus the time a merge takes behind the updates. Call flush()
+ * to merge synchronously when a read must include everything added so far.
+ *
+ * <p>A shard is locked only by its own thread, once per update call or per block of an
+ * array update, and briefly by the merge when it swaps the shard for an empty one. All
+ * methods may be called from any thread, except reset(), which must not run concurrently
+ * with updates.
+ */
+class ShardedHllSketch final : public BaseHllSketch {
+  public:
+    explicit ShardedHllSketch(const int lgConfigK, const TgtHllType tgtHllType,
+                              const int mergeIntervalMillis);
+    explicit ShardedHllSketch(const int lgConfigK, const TgtHllType tgtHllType,
+                              const int mergeIntervalMillis, const HashType hashType);
+    ShardedHllSketch(const ShardedHllSketch& that) = delete;
+    ShardedHllSketch& operator=(const ShardedHllSketch& that) = delete;
+
+    virtual ~ShardedHllSketch();
+
+    double getEstimate();
+    double getCompositeEstimate();
+    double getLowerBound(const int numStdDev);
+    double getUpperBound(const int numStdDev);
+
+    int getCompactSerializationBytes();
+    int getUpdatableSerializationBytes();
+    int getLgConfigK();
+    int getMergeIntervalMillis();
+
+    CurMode getCurMode();
+    TgtHllType getTgtHllType();
+    bool isCompact();
+    bool isEmpty();
+
+    void reset();
+
+    // Merges every shard now and publishes the result before returning.
+    void flush();
+
+    // Returns a copy of the latest snapshot. The caller owns the result.
+    HllSketch* getResult(const TgtHllType tgtHllType);
+
+    std::ostream& to_string(std::ostream& os, const bool summary,
+                            const bool detail, const bool auxDetail, const bool all);
+
+  protected:
+    virtual void couponUpdate(int coupon);
+    virtual void couponUpdate(const int coupons[], const int len);
+    virtual bool isOutOfOrderFlag();
+
+  private:
+    struct Shard;
+
+    Shard* localShard();
+    void mergeLoop();
+    void mergeShards(); // caller holds mergeMutex
+
+    const int lgConfigK;
+    const TgtHllType tgtHllType;
+    const int mergeIntervalMillis;
+    const uint64_t id; // never reused, unlike the address, to find the thread's shard
+
+    std::mutex shardsMutex;
+    std::vector<Shard*> shards;
+
+    std::mutex mergeMutex; // held while merging into hllUnion
+    HllUnion* hllUnion;
+
+    std::mutex snapshotMutex;
+    HllSketch* snapshot; // HLL_8 copy of the union as of the last merge
+
+    std::mutex stopMutex;
+    std::condition_variable stopCondition;
+    bool stopping;
+    std::thread merger;
+};
+
+}
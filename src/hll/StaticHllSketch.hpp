@@ -0,0 +1,570 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+#pragma once
+
+#include "HllSketch.hpp"
+#include "HllArray.hpp"
+#include "Hll4Array.hpp"
+#include "AbstractCoupons.hpp"
+#include "CouponHashSet.hpp"
+#include "AuxHashMap.hpp"
+#include "MurmurHash3.h"
+#include "MurmurHash3Fixed.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+
+namespace datasketches {
+
+/**
+ * An HLL sketch whose lgConfigK and target type are fixed at compile time.
+ *
+ * <p>It follows the same LIST, SET and HLL modes as HllSketch and produces the same
+ * estimates for the same input, but the mode is a plain field and every mask, shift and
+ * array size is a compile-time constant, so an update makes no virtual calls. Keys are
+ * hashed with MurmurHash3 like a default HllSketch.
+ *
+ * <p>Use copyAsHllSketch() to hand the state to HllUnion or to code that expects an
+ * HllSketch; HllUnion::update() also accepts a StaticHllSketch directly.
+ *
+ * @tparam LgK log2 of K, between 4 and 21 inclusive
+ * @tparam TgtType HLL_4 or HLL_8
+ */
+template<int LgK, TgtHllType TgtType>
+class StaticHllSketch {
+  static_assert((LgK >= HllUtil::MIN_LOG_K) && (LgK <= HllUtil::MAX_LOG_K),
+                "LgK must be between 4 and 21 inclusive");
+  static_assert((TgtType == HLL_4) || (TgtType == HLL_8), "Only HLL_4, HLL_8 supported");
+
+  public:
+    static const int CONFIG_K = 1 << LgK;
+
+    explicit StaticHllSketch();
+    StaticHllSketch(const StaticHllSketch& that);
+    StaticHllSketch& operator=(const StaticHllSketch& that) = delete;
+    ~StaticHllSketch();
+
+    void reset();
+
+    void update(const std::string& datum);
+    void update(const uint64_t datum);
+    void update(const double datum);
+    void update(const void* data, const size_t len);
+    void update(const uint64_t* data, const size_t len);
+    void update(const double* data, const size_t len);
+    void update_hash(const uint64_t hash[2]);
+
+    double getEstimate();
+    double getCompositeEstimate();
+    double getLowerBound(const int numStdDev);
+    double getUpperBound(const int numStdDev);
+
+    int getLgConfigK();
+    TgtHllType getTgtHllType();
+    CurMode getCurMode();
+    bool isEmpty();
+    bool isOutOfOrderFlag();
+
+    // Returns a new HllSketch in the same state as this one. The caller owns the result.
+    HllSketch* copyAsHllSketch();
+
+  private:
+    static const int CONFIG_K_MASK = CONFIG_K - 1;
+    static const int HLL_BYTES = (TgtType == HLL_4) ? (CONFIG_K >> 1) : CONFIG_K;
+    // a SET is used only for LgK >= 8 and promotes to HLL once it needs more than K/8 ints
+    static const int LG_MAX_SET_INTS = LgK - 3;
+    static const int BLOCK_SIZE = 64;
+
+    void init();
+    void freeArrays();
+
+    void couponUpdate(const int coupon);
+    void listUpdate(const int coupon);
+    void setUpdate(const int coupon);
+    void growSet(const int tgtLgCoupArrInts);
+    void promoteListToSet();
+    void promoteToHll();
+
+    void hllUpdate(const int coupon);
+    void hll4Update(const int slotNo, const int newVal);
+    void shiftToBiggerCurMin();
+    int getNibble(const int slotNo);
+    void putNibble(const int slotNo, const int value);
+    void hipAndKxQIncrementalUpdate(const int oldValue, const int newValue);
+
+    CurMode curMode;
+    bool oooFlag;
+
+    // LIST and SET
+    int lgCouponArrInts;
+    int couponCount;
+    int* couponIntArr;
+
+    // HLL
+    uint8_t* hllByteArr;
+    AuxHashMap* auxHashMap; // HLL_4 exceptions, may be null
+    double hipAccum;
+    double kxq0;
+    double kxq1;
+    int curMin; // always zero for HLL_8
+    int numAtCurMin; // num zeros when curMin == 0
+};
+
+template<int LgK, TgtHllType TgtType>
+StaticHllSketch<LgK, TgtType>::StaticHllSketch() {
+  init();
+}
+
+template<int LgK, TgtHllType TgtType>
+StaticHllSketch<LgK, TgtType>::StaticHllSketch(const StaticHllSketch& that)
+  : curMode(that.curMode),
+    oooFlag(that.oooFlag),
+    lgCouponArrInts(that.lgCouponArrInts),
+    couponCount(that.couponCount),
+    couponIntArr(nullptr),
+    hllByteArr(nullptr),
+    auxHashMap(nullptr),
+    hipAccum(that.hipAccum),
+    kxq0(that.kxq0),
+    kxq1(that.kxq1),
+    curMin(that.curMin),
+    numAtCurMin(that.numAtCurMin) {
+  if (that.couponIntArr != nullptr) {
+    const int len = 1 << lgCouponArrInts;
+    couponIntArr = new int[len];
+    std::copy(that.couponIntArr, that.couponIntArr + len, couponIntArr);
+  }
+  if (that.hllByteArr != nullptr) {
+    hllByteArr = new uint8_t[HLL_BYTES];
+    std::copy(that.hllByteArr, that.hllByteArr + HLL_BYTES, hllByteArr);
+  }
+  if (that.auxHashMap != nullptr) {
+    auxHashMap = that.auxHashMap->copy();
+  }
+}
+
+template<int LgK, TgtHllType TgtType>
+StaticHllSketch<LgK, TgtType>::~StaticHllSketch() {
+  freeArrays();
+}
+
+template<int LgK, TgtHllType TgtType>
+void StaticHllSketch<LgK, TgtType>::init() {
+  curMode = CurMode::LIST;
+  oooFlag = false;
+  lgCouponArrInts = HllUtil::LG_INIT_LIST_SIZE;
+  couponCount = 0;
+  couponIntArr = new int[1 << lgCouponArrInts]();
+  hllByteArr = nullptr;
+  auxHashMap = nullptr;
+  hipAccum = 0.0;
+  kxq0 = CONFIG_K;
+  kxq1 = 0.0;
+  curMin = 0;
+  numAtCurMin = CONFIG_K;
+}
+
+template<int LgK, TgtHllType TgtType>
+void StaticHllSketch<LgK, TgtType>::freeArrays() {
+  delete[] couponIntArr;
+  delete[] hllByteArr;
+  delete auxHashMap;
+  couponIntArr = nullptr;
+  hllByteArr = nullptr;
+  auxHashMap = nullptr;
+}
+
+template<int LgK, TgtHllType TgtType>
+void StaticHllSketch<LgK, TgtType>::reset() {
+  freeArrays();
+  init();
+}
+
+template<int LgK, TgtHllType TgtType>
+void StaticHllSketch<LgK, TgtType>::update(const std::string& datum) {
+  if (datum.empty()) { return; }
+  update(datum.c_str(), datum.length());
+}
+
+template<int LgK, TgtHllType TgtType>
+void StaticHllSketch<LgK, TgtType>::update(const uint64_t datum) {
+  uint64_t hash[2];
+  MurmurHash3Fixed::hash8(&datum, HllUtil::DEFAULT_UPDATE_SEED, hash);
+  couponUpdate(BaseHllSketch::coupon(hash));
+}
+
+template<int LgK, TgtHllType TgtType>
+void StaticHllSketch<LgK, TgtType>::update(const double datum) {
+  const double d = HllUtil::canonicalize(datum);
+  uint64_t hash[2];
+  MurmurHash3Fixed::hash8(&d, HllUtil::DEFAULT_UPDATE_SEED, hash);
+  couponUpdate(BaseHllSketch::coupon(hash));
+}
+
+template<int LgK, TgtHllType TgtType>
+void StaticHllSketch<LgK, TgtType>::update(const void* data, const size_t len) {
+  if (data == nullptr) { return; }
+  uint64_t hash[2];
+  MurmurHash3_x64_128(data, (int) len, HllUtil::DEFAULT_UPDATE_SEED, hash);
+  couponUpdate(BaseHllSketch::coupon(hash));
+}
+
+template<int LgK, TgtHllType TgtType>
+void StaticHllSketch<LgK, TgtType>::update(const uint64_t* data, const size_t len) {
+  if (data == nullptr) { return; }
+  uint64_t hashes[2 * BLOCK_SIZE];
+  for (size_t i = 0; i < len; i += BLOCK_SIZE) {
+    const int blockLen = (int) std::min<size_t>(BLOCK_SIZE, len - i);
+    MurmurHash3_x64_128_keys8(&data[i], blockLen, HllUtil::DEFAULT_UPDATE_SEED, hashes);
+    for (int j = 0; j < blockLen; ++j) {
+      couponUpdate(BaseHllSketch::coupon(&hashes[2 * j]));
+    }
+  }
+}
+
+template<int LgK, TgtHllType TgtType>
+void StaticHllSketch<LgK, TgtType>::update(const double* data, const size_t len) {
+  if (data == nullptr) { return; }
+  uint64_t keys[BLOCK_SIZE];
+  uint64_t hashes[2 * BLOCK_SIZE];
+  for (size_t i = 0; i < len; i += BLOCK_SIZE) {
+    const int blockLen = (int) std::min<size_t>(BLOCK_SIZE, len - i);
+    for (int j = 0; j < blockLen; ++j) {
+      const double d = HllUtil::canonicalize(data[i + j]);
+      std::memcpy(&keys[j], &d, sizeof(d));
+    }
+    MurmurHash3_x64_128_keys8(keys, blockLen, HllUtil::DEFAULT_UPDATE_SEED, hashes);
+    for (int j = 0; j < blockLen; ++j) {
+      couponUpdate(BaseHllSketch::coupon(&hashes[2 * j]));
+    }
+  }
+}
+
+template<int LgK, TgtHllType TgtType>
+void StaticHllSketch<LgK, TgtType>::update_hash(const uint64_t hash[2]) {
+  couponUpdate(BaseHllSketch::coupon(hash));
+}
+
+template<int LgK, TgtHllType TgtType>
+inline void StaticHllSketch<LgK, TgtType>::couponUpdate(const int coupon) {
+  if (curMode == CurMode::HLL) {
+    hllUpdate(coupon);
+  } else if (curMode == CurMode::LIST) {
+    listUpdate(coupon);
+  } else {
+    setUpdate(coupon);
+  }
+}
+
+// Same as CouponList::couponUpdate()
+template<int LgK, TgtHllType TgtType>
+void StaticHllSketch<LgK, TgtType>::listUpdate(const int coupon) {
+  const int len = 1 << HllUtil::LG_INIT_LIST_SIZE;
+  for (int i = 0; i < len; ++i) {
+    const int couponAtIdx = couponIntArr[i];
+    if (couponAtIdx == HllUtil::EMPTY) {
+      couponIntArr[i] = coupon;
+      ++couponCount;
+      if (couponCount >= len) {
+        if (LgK < 8) {
+          promoteToHll();
+        } else {
+          promoteListToSet();
+        }
+      }
+      return;
+    }
+    if (couponAtIdx == coupon) {
+      return; // duplicate
+    }
+  }
+  throw std::runtime_error("Array invalid: no empties and no duplicates");
+}
+
+// Same as CouponHashSet::couponUpdate()
+template<int LgK, TgtHllType TgtType>
+void StaticHllSketch<LgK, TgtType>::setUpdate(const int coupon) {
+  const int index = CouponHashSet::find(couponIntArr, lgCouponArrInts, coupon);
+  if (index >= 0) {
+    return; // duplicate
+  }
+  couponIntArr[~index] = coupon;
+  ++couponCount;
+  if ((HllUtil::RESIZE_DENOM * couponCount) > (HllUtil::RESIZE_NUMER * (1 << lgCouponArrInts))) {
+    if (lgCouponArrInts == LG_MAX_SET_INTS) {
+      promoteToHll();
+    } else {
+      growSet(lgCouponArrInts + 1);
+    }
+  }
+}
+
+template<int LgK, TgtHllType TgtType>
+void StaticHllSketch<LgK, TgtType>::growSet(const int tgtLgCoupArrInts) {
+  const int srcLen = 1 << lgCouponArrInts;
+  int* tgtArr = new int[1 << tgtLgCoupArrInts]();
+  for (int i = 0; i < srcLen; ++i) {
+    const int fetched = couponIntArr[i];
+    if (fetched != HllUtil::EMPTY) {
+      tgtArr[~CouponHashSet::find(tgtArr, tgtLgCoupArrInts, fetched)] = fetched;
+    }
+  }
+  delete[] couponIntArr;
+  couponIntArr = tgtArr;
+  lgCouponArrInts = tgtLgCoupArrInts;
+}
+
+// Same as CouponList::promoteHeapListToSet()
+template<int LgK, TgtHllType TgtType>
+void StaticHllSketch<LgK, TgtType>::promoteListToSet() {
+  int* listArr = couponIntArr;
+  const int listLen = 1 << lgCouponArrInts;
+  curMode = CurMode::SET;
+  lgCouponArrInts = HllUtil::LG_INIT_SET_SIZE;
+  couponCount = 0;
+  couponIntArr = new int[1 << lgCouponArrInts]();
+  for (int i = 0; i < listLen; ++i) {
+    setUpdate(listArr[i]);
+  }
+  oooFlag = true;
+  delete[] listArr;
+}
+
+// Same as CouponList::promoteHeapListOrSetToHll()
+template<int LgK, TgtHllType TgtType>
+void StaticHllSketch<LgK, TgtType>::promoteToHll() {
+  int* srcArr = couponIntArr;
+  const int srcLen = 1 << lgCouponArrInts;
+  const double srcEstimate = AbstractCoupons::couponEstimate(couponCount);
+
+  curMode = CurMode::HLL;
+  couponIntArr = nullptr;
+  lgCouponArrInts = 0;
+  couponCount = 0;
+  hllByteArr = new uint8_t[HLL_BYTES]();
+  for (int i = 0; i < srcLen; ++i) {
+    if (srcArr[i] != HllUtil::EMPTY) {
+      hllUpdate(srcArr[i]);
+    }
+  }
+  hipAccum = srcEstimate;
+  oooFlag = false;
+  delete[] srcArr;
+}
+
+template<int LgK, TgtHllType TgtType>
+inline void StaticHllSketch<LgK, TgtType>::hllUpdate(const int coupon) {
+  const int slotNo = HllUtil::getLow26(coupon) & CONFIG_K_MASK;
+  const int newVal = HllUtil::getValue(coupon);
+  if (TgtType == HLL_8) {
+    const int curVal = hllByteArr[slotNo];
+    if (newVal > curVal) {
+      hllByteArr[slotNo] = (uint8_t) newVal;
+      hipAndKxQIncrementalUpdate(curVal, newVal);
+      if (curVal == 0) {
+        --numAtCurMin; // num zeros
+      }
+    }
+  } else {
+    if (newVal <= curMin) {
+      return; // quick rejection
+    }
+    hll4Update(slotNo, newVal);
+  }
+}
+
+template<int LgK, TgtHllType TgtType>
+inline void StaticHllSketch<LgK, TgtType>::hipAndKxQIncrementalUpdate(const int oldValue,
+                                                                      const int newValue) {
+  // update hipAccum BEFORE updating kxq0 and kxq1
+  hipAccum += CONFIG_K / (kxq0 + kxq1);
+  if (oldValue < 32) { kxq0 -= HllUtil::invPow2(oldValue); }
+  else               { kxq1 -= HllUtil::invPow2(oldValue); }
+  if (newValue < 32) { kxq0 += HllUtil::invPow2(newValue); }
+  else               { kxq1 += HllUtil::invPow2(newValue); }
+}
+
+template<int LgK, TgtHllType TgtType>
+inline int StaticHllSketch<LgK, TgtType>::getNibble(const int slotNo) {
+  const int theByte = hllByteArr[slotNo >> 1];
+  return ((slotNo & 1) ? (theByte >> 4) : theByte) & HllUtil::loNibbleMask;
+}
+
+template<int LgK, TgtHllType TgtType>
+inline void StaticHllSketch<LgK, TgtType>::putNibble(const int slotNo, const int value) {
+  uint8_t& theByte = hllByteArr[slotNo >> 1];
+  if ((slotNo & 1) == 0) {
+    theByte = (uint8_t) ((theByte & HllUtil::hiNibbleMask) | (value & HllUtil::loNibbleMask));
+  } else {
+    theByte = (uint8_t) ((theByte & HllUtil::loNibbleMask) | ((value << 4) & HllUtil::hiNibbleMask));
+  }
+}
+
+// Same as Hll4Array::internalHll4Update()
+template<int LgK, TgtHllType TgtType>
+void StaticHllSketch<LgK, TgtType>::hll4Update(const int slotNo, const int newVal) {
+  const int rawStoredOldValue = getNibble(slotNo);
+  const int lbOnOldValue = rawStoredOldValue + curMin;
+  if (newVal <= lbOnOldValue) { return; }
+
+  const int actualOldValue = (rawStoredOldValue < HllUtil::AUX_TOKEN)
+      ? lbOnOldValue : auxHashMap->mustFindValueFor(slotNo);
+  if (newVal <= actualOldValue) { return; }
+
+  hipAndKxQIncrementalUpdate(actualOldValue, newVal);
+  const int shiftedNewValue = newVal - curMin;
+
+  if (rawStoredOldValue == HllUtil::AUX_TOKEN) {
+    // old value is an exception, so the new larger one is too
+    auxHashMap->mustReplace(slotNo, newVal);
+  } else if (shiftedNewValue >= HllUtil::AUX_TOKEN) {
+    putNibble(slotNo, HllUtil::AUX_TOKEN);
+    if (auxHashMap == nullptr) {
+      std::pmr::memory_resource* resource = std::pmr::get_default_resource();
+      auxHashMap = new (resource) AuxHashMap(HllUtil::LG_AUX_ARR_INTS[LgK], LgK, resource);
+    }
+    auxHashMap->mustAdd(slotNo, newVal);
+  } else {
+    putNibble(slotNo, shiftedNewValue);
+  }
+
+  if (actualOldValue == curMin) {
+    --numAtCurMin;
+    while (numAtCurMin == 0) {
+      shiftToBiggerCurMin();
+    }
+  }
+}
+
+// Same as Hll4Array::shiftToBiggerCurMin()
+template<int LgK, TgtHllType TgtType>
+void StaticHllSketch<LgK, TgtType>::shiftToBiggerCurMin() {
+  const int newCurMin = curMin + 1;
+  int numAuxTokens = 0;
+  const int numAtNewCurMin = Hll4Array::decrementNibbles(hllByteArr, HLL_BYTES, numAuxTokens);
+
+  AuxHashMap* newAuxMap = nullptr;
+  if (auxHashMap != nullptr) {
+    auxHashMap->forEachEntry([&](const int key, const int oldActualVal) {
+      const int slotNum = key & CONFIG_K_MASK;
+      const int newShiftedVal = oldActualVal - newCurMin;
+      if (newShiftedVal < HllUtil::AUX_TOKEN) {
+        putNibble(slotNum, newShiftedVal); // no longer an exception
+        --numAuxTokens;
+      } else {
+        if (newAuxMap == nullptr) {
+          std::pmr::memory_resource* resource = std::pmr::get_default_resource();
+          newAuxMap = new (resource) AuxHashMap(HllUtil::LG_AUX_ARR_INTS[LgK], LgK, resource);
+        }
+        newAuxMap->mustAdd(slotNum, oldActualVal);
+      }
+    });
+  }
+
+  if ((newAuxMap != nullptr) && (newAuxMap->getAuxCount() != numAuxTokens)) {
+    delete newAuxMap;
+    throw std::runtime_error("AuxHashMap count does not match the number of AUX_TOKENs");
+  }
+
+  delete auxHashMap;
+  auxHashMap = newAuxMap;
+  curMin = newCurMin;
+  numAtCurMin = numAtNewCurMin;
+}
+
+template<int LgK, TgtHllType TgtType>
+double StaticHllSketch<LgK, TgtType>::getEstimate() {
+  if (curMode != CurMode::HLL) {
+    return AbstractCoupons::couponEstimate(couponCount);
+  }
+  return oooFlag ? getCompositeEstimate() : hipAccum;
+}
+
+template<int LgK, TgtHllType TgtType>
+double StaticHllSketch<LgK, TgtType>::getCompositeEstimate() {
+  if (curMode != CurMode::HLL) {
+    return AbstractCoupons::couponEstimate(couponCount);
+  }
+  return HllArray::hllCompositeEstimate(LgK, kxq0 + kxq1, curMin, numAtCurMin);
+}
+
+template<int LgK, TgtHllType TgtType>
+double StaticHllSketch<LgK, TgtType>::getLowerBound(const int numStdDev) {
+  if (curMode != CurMode::HLL) {
+    return AbstractCoupons::couponLowerBound(couponCount, numStdDev);
+  }
+  HllUtil::checkNumStdDev(numStdDev);
+  const double estimate = oooFlag ? getCompositeEstimate() : hipAccum;
+  return HllArray::hllLowerBound(LgK, oooFlag, estimate, curMin, numAtCurMin, numStdDev);
+}
+
+template<int LgK, TgtHllType TgtType>
+double StaticHllSketch<LgK, TgtType>::getUpperBound(const int numStdDev) {
+  if (curMode != CurMode::HLL) {
+    return AbstractCoupons::couponUpperBound(couponCount, numStdDev);
+  }
+  HllUtil::checkNumStdDev(numStdDev);
+  const double estimate = oooFlag ? getCompositeEstimate() : hipAccum;
+  return HllArray::hllUpperBound(LgK, oooFlag, estimate, numStdDev);
+}
+
+template<int LgK, TgtHllType TgtType>
+int StaticHllSketch<LgK, TgtType>::getLgConfigK() {
+  return LgK;
+}
+
+template<int LgK, TgtHllType TgtType>
+TgtHllType StaticHllSketch<LgK, TgtType>::getTgtHllType() {
+  return TgtType;
+}
+
+template<int LgK, TgtHllType TgtType>
+CurMode StaticHllSketch<LgK, TgtType>::getCurMode() {
+  return curMode;
+}
+
+template<int LgK, TgtHllType TgtType>
+bool StaticHllSketch<LgK, TgtType>::isEmpty() {
+  if (curMode != CurMode::HLL) {
+    return couponCount == 0;
+  }
+  return (curMin == 0) && (numAtCurMin == CONFIG_K);
+}
+
+template<int LgK, TgtHllType TgtType>
+bool StaticHllSketch<LgK, TgtType>::isOutOfOrderFlag() {
+  return oooFlag;
+}
+
+template<int LgK, TgtHllType TgtType>
+HllSketch* StaticHllSketch<LgK, TgtType>::copyAsHllSketch() {
+  HllSketch* sketch = new HllSketch(LgK, TgtType);
+  if (curMode != CurMode::HLL) {
+    // Replaying the coupons reproduces the list exactly, or a set with the same
+    // contents; mode changes depend only on the coupon count.
+    sketch->update_coupons(couponIntArr, 1 << lgCouponArrInts);
+    return sketch;
+  }
+
+  HllArray* hllArr = HllArray::newHll(LgK, TgtType, std::pmr::get_default_resource());
+  std::copy(hllByteArr, hllByteArr + HLL_BYTES, hllArr->hllByteArr);
+  hllArr->putCurMin(curMin);
+  hllArr->putNumAtCurMin(numAtCurMin);
+  hllArr->putHipAccum(hipAccum);
+  hllArr->putKxQ0(kxq0);
+  hllArr->putKxQ1(kxq1);
+  hllArr->putOutOfOrderFlag(oooFlag);
+  if ((TgtType == HLL_4) && (auxHashMap != nullptr)) {
+    ((Hll4Array*) hllArr)->putAuxHashMap(auxHashMap->copy());
+  }
+  delete sketch->getImpl();
+  sketch->putImpl(hllArr);
+  return sketch;
+}
+
+}
@@ -0,0 +1,170 @@
+/*
+ * Copyright 2018, Yahoo! Inc. Licensed under the terms of the
+ * Apache License 2.0. See LICENSE file at the project root for terms.
+ */
+
+// Multi-lane MurmurHash3_x64_128 for 8-byte keys. With len == 8 the block loop
+// never runs and only the k1 tail step, the length mix and finalization remain,
+// so each lane performs exactly the scalar arithmetic on one key. The vector
+// kernels are compiled with target attributes and picked at runtime.
+
+#include "MurmurHash3.h"
+#include "MurmurHash3Fixed.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define MURMUR3_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+namespace {
+
+const uint64_t c1 = 0x87c37b91114253d5LLU;
+const uint64_t c2 = 0x4cf5ad432745937fLLU;
+const uint64_t fmixC1 = 0xff51afd7ed558ccdLLU;
+const uint64_t fmixC2 = 0xc4ceb9fe1a85ec53LLU;
+const uint64_t keyLen = 8;
+
+void keys8Scalar(const uint64_t* keys, int n, uint64_t seed, uint64_t* out) {
+  for (int i = 0; i < n; ++i) {
+    datasketches::MurmurHash3Fixed::hash8(&keys[i], seed, &out[2 * i]);
+  }
+}
+
+#ifdef MURMUR3_X86_DISPATCH
+
+//-----------------------------------------------------------------------------
+// AVX2: 4 lanes. There is no 64-bit multiply, so build it from 32-bit halves.
+
+__attribute__((target("avx2")))
+inline __m256i mul64Avx2(__m256i a, const uint64_t b) {
+  const __m256i bLo = _mm256_set1_epi64x(b & 0xffffffffLLU);
+  const __m256i bHi = _mm256_set1_epi64x(b >> 32);
+  const __m256i lo = _mm256_mul_epu32(a, bLo);
+  const __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), bLo),
+                                         _mm256_mul_epu32(a, bHi));
+  return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+
+__attribute__((target("avx2")))
+inline __m256i rotl64Avx2(__m256i x, const int r) {
+  return _mm256_or_si256(_mm256_slli_epi64(x, r), _mm256_srli_epi64(x, 64 - r));
+}
+
+__attribute__((target("avx2")))
+inline __m256i fmix64Avx2(__m256i k) {
+  k = _mm256_xor_si256(k, _mm256_srli_epi64(k, 33));
+  k = mul64Avx2(k, fmixC1);
+  k = _mm256_xor_si256(k, _mm256_srli_epi64(k, 33));
+  k = mul64Avx2(k, fmixC2);
+  k = _mm256_xor_si256(k, _mm256_srli_epi64(k, 33));
+  return k;
+}
+
+__attribute__((target("avx2")))
+void keys8Avx2(const uint64_t* keys, int n, uint64_t seed, uint64_t* out) {
+  const __m256i h2Init = _mm256_set1_epi64x(seed ^ keyLen);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i k1 = _mm256_loadu_si256((const __m256i*) &keys[i]);
+    k1 = mul64Avx2(k1, c1);
+    k1 = rotl64Avx2(k1, 31);
+    k1 = mul64Avx2(k1, c2);
+
+    // h1 = (seed ^ k1) ^ len, h2 = seed ^ len
+    __m256i h1 = _mm256_xor_si256(h2Init, k1);
+    __m256i h2 = h2Init;
+
+    h1 = _mm256_add_epi64(h1, h2);
+    h2 = _mm256_add_epi64(h2, h1);
+    h1 = fmix64Avx2(h1);
+    h2 = fmix64Avx2(h2);
+    h1 = _mm256_add_epi64(h1, h2);
+    h2 = _mm256_add_epi64(h2, h1);
+
+    // interleave to {h1, h2} pairs per key
+    const __m256i lo = _mm256_unpacklo_epi64(h1, h2); // keys 0, 2
+    const __m256i hi = _mm256_unpackhi_epi64(h1, h2); // keys 1, 3
+    _mm256_storeu_si256((__m256i*) &out[2 * i], _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256((__m256i*) &out[2 * i + 4], _mm256_permute2x128_si256(lo, hi, 0x31));
+  }
+  keys8Scalar(keys + i, n - i, seed, out + (2 * i));
+}
+
+//-----------------------------------------------------------------------------
+// AVX-512: 8 lanes with native 64-bit multiply (DQ) and rotate (F).
+
+// GCC 12 reports its own _mm512_undefined_epi32() as maybe-uninitialized
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+__attribute__((target("avx512f,avx512dq")))
+inline __m512i fmix64Avx512(__m512i k) {
+  k = _mm512_xor_si512(k, _mm512_srli_epi64(k, 33));
+  k = _mm512_mullo_epi64(k, _mm512_set1_epi64(fmixC1));
+  k = _mm512_xor_si512(k, _mm512_srli_epi64(k, 33));
+  k = _mm512_mullo_epi64(k, _mm512_set1_epi64(fmixC2));
+  k = _mm512_xor_si512(k, _mm512_srli_epi64(k, 33));
+  return k;
+}
+
+__attribute__((target("avx512f,avx512dq")))
+void keys8Avx512(const uint64_t* keys, int n, uint64_t seed, uint64_t* out) {
+  const __m512i h2Init = _mm512_set1_epi64(seed ^ keyLen);
+  const __m512i c1v = _mm512_set1_epi64(c1);
+  const __m512i c2v = _mm512_set1_epi64(c2);
+  const __m512i idxLo = _mm512_set_epi64(11, 3, 10, 2, 9, 1, 8, 0);
+  const __m512i idxHi = _mm512_set_epi64(15, 7, 14, 6, 13, 5, 12, 4);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m512i k1 = _mm512_loadu_si512((const void*) &keys[i]);
+    k1 = _mm512_mullo_epi64(k1, c1v);
+    k1 = _mm512_rol_epi64(k1, 31);
+    k1 = _mm512_mullo_epi64(k1, c2v);
+
+    __m512i h1 = _mm512_xor_si512(h2Init, k1);
+    __m512i h2 = h2Init;
+
+    h1 = _mm512_add_epi64(h1, h2);
+    h2 = _mm512_add_epi64(h2, h1);
+    h1 = fmix64Avx512(h1);
+    h2 = fmix64Avx512(h2);
+    h1 = _mm512_add_epi64(h1, h2);
+    h2 = _mm512_add_epi64(h2, h1);
+
+    _mm512_storeu_si512((void*) &out[2 * i], _mm512_permutex2var_epi64(h1, idxLo, h2));
+    _mm512_storeu_si512((void*) &out[2 * i + 8], _mm512_permutex2var_epi64(h1, idxHi, h2));
+  }
+  keys8Avx2(keys + i, n - i, seed, out + (2 * i));
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif // MURMUR3_X86_DISPATCH
+
+typedef void (*Keys8Fn)(const uint64_t*, int, uint64_t, uint64_t*);
+
+Keys8Fn selectKeys8() {
+#ifdef MURMUR3_X86_DISPATCH
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq")) {
+    return keys8Avx512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return keys8Avx2;
+  }
+#endif
+  return keys8Scalar;
+}
+
+} // namespace
+
+void MurmurHash3_x64_128_keys8 ( const uint64_t * keys, const int n,
+                                 const uint64_t seed, uint64_t * out )
+{
+  static const Keys8Fn impl = selectKeys8();
+  impl(keys, n, seed, out);
+}
@@ -3,14 +3,34 @@
  * Apache License 2.0. See LICENSE file at the project root for terms.
  */
 
+#include "src/hll/CompositeInterpolationXTable.hpp"
+#include "src/hll/ConcurrentHllSketch.hpp"
+#include "src/hll/CouponList.hpp"
 #include "src/hll/HllSketch.hpp"
+#include "src/hll/HllSketchPool.hpp"
 #include "src/hll/HllUnion.hpp"
 #include "src/hll/HllUtil.hpp"
+#include "src/hll/Hll4Array.hpp"
+#include "src/hll/Hll8Array.hpp"
+#include "src/hll/MurmurHash3.h"
+#include "src/hll/MurmurHash3Fixed.hpp"
+#include "src/hll/RegisterScan.hpp"
+#include "src/hll/ShardedHllSketch.hpp"
+#include "src/hll/StaticHllSketch.hpp"
 
 #include <cppunit/TestFixture.h>
 #include <cppunit/extensions/HelperMacros.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
 #include <cstring>
+#include <map>
+#include <memory_resource>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
 
 // this is for debug printing of hll_sketch using ostream& operator<<()
 /*
@@ -31,6 +51,29 @@ class hll_sketch_test: public CppUnit::TestFixture {
   CPPUNIT_TEST_SUITE(hll_sketch_test);
   CPPUNIT_TEST(simple_union);
   CPPUNIT_TEST(k_limits);
+  CPPUNIT_TEST(batch_update);
+  CPPUNIT_TEST(hash_keys8);
+  CPPUNIT_TEST(hash_fixed_width);
+  CPPUNIT_TEST(hash_type);
+  CPPUNIT_TEST(prehashed_update);
+  CPPUNIT_TEST(static_sketch);
+  CPPUNIT_TEST(decrement_nibbles);
+  CPPUNIT_TEST(incremental_shift);
+  CPPUNIT_TEST(estimate_cache);
+  CPPUNIT_TEST(register_scan);
+  CPPUNIT_TEST(union_hll8_merge);
+  CPPUNIT_TEST(union_hll4_merge);
+  CPPUNIT_TEST(union_downsample);
+  CPPUNIT_TEST(parallel_union);
+  CPPUNIT_TEST(concurrent_sketch);
+  CPPUNIT_TEST(sharded_sketch);
+  CPPUNIT_TEST(for_each_valid);
+  CPPUNIT_TEST(value_histogram);
+  CPPUNIT_TEST(improved_estimate);
+  CPPUNIT_TEST(find_straddle);
+  CPPUNIT_TEST(batch_estimates);
+  CPPUNIT_TEST(memory_resource);
+  CPPUNIT_TEST(sketch_pool);
   //CPPUNIT_TEST(empty);
   CPPUNIT_TEST_SUITE_END();
 
@@ -65,6 +108,961 @@ class hll_sketch_test: public CppUnit::TestFixture {
     CPPUNIT_ASSERT_THROW(new HllSketch(HllUtil::MAX_LOG_K + 1, TgtHllType::HLL_8), std::invalid_argument);
   }
 
+  void hash_keys8() {
+    const int n = 37; // exercises full vectors and the scalar tail
+    uint64_t keys[n];
+    for (int i = 0; i < n; ++i) {
+      keys[i] = (i * 0x9E3779B97F4A7C15ULL) ^ (i == 0 ? 0 : ~0ULL);
+    }
+    uint64_t expected[2 * n];
+    uint64_t actual[2 * n];
+    for (int i = 0; i < n; ++i) {
+      MurmurHash3_x64_128(&keys[i], sizeof(uint64_t), 9001, &expected[2 * i]);
+    }
+    MurmurHash3_x64_128_keys8(keys, n, 9001, actual);
+    for (int i = 0; i < 2 * n; ++i) {
+      CPPUNIT_ASSERT_EQUAL(expected[i], actual[i]);
+    }
+  }
+
+  void hash_fixed_width() {
+    uint64_t expected[2];
+    uint64_t actual[2];
+    for (uint64_t i = 0; i < 1000; ++i) {
+      const uint64_t key[2] = { i * 0x9E3779B97F4A7C15ULL, ~i };
+      const uint64_t seed = (i & 1) ? 9001 : i;
+      MurmurHash3_x64_128(key, 4, seed, expected);
+      MurmurHash3Fixed::hash4(key, seed, actual);
+      CPPUNIT_ASSERT(std::memcmp(expected, actual, sizeof(expected)) == 0);
+      MurmurHash3_x64_128(key, 8, seed, expected);
+      MurmurHash3Fixed::hash8(key, seed, actual);
+      CPPUNIT_ASSERT(std::memcmp(expected, actual, sizeof(expected)) == 0);
+      MurmurHash3_x64_128(key, 16, seed, expected);
+      MurmurHash3Fixed::hash16(key, seed, actual);
+      CPPUNIT_ASSERT(std::memcmp(expected, actual, sizeof(expected)) == 0);
+    }
+  }
+
+  void hash_type() {
+    const int n = 100000;
+    std::vector<uint64_t> keys(n);
+    for (int i = 0; i < n; ++i) { keys[i] = i; }
+
+    HllSketch single(12, TgtHllType::HLL_8, HashType::XXH3_128);
+    HllSketch batch(12, TgtHllType::HLL_8, HashType::XXH3_128);
+    for (int i = 0; i < n; ++i) { single.update(keys[i]); }
+    batch.update(keys.data(), n);
+    CPPUNIT_ASSERT_EQUAL(HashType::XXH3_128, single.getHashType());
+    CPPUNIT_ASSERT_EQUAL(single.getEstimate(), batch.getEstimate());
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(n, single.getEstimate(), n * 0.05);
+
+    HllSketch murmur(12, TgtHllType::HLL_8);
+    murmur.update(keys.data(), n);
+    CPPUNIT_ASSERT(murmur.getEstimate() != single.getEstimate());
+
+    HllUnion murmurUnion(12);
+    CPPUNIT_ASSERT_THROW(murmurUnion.update(single), std::invalid_argument);
+    HllUnion xxhUnion(12, HashType::XXH3_128);
+    CPPUNIT_ASSERT_THROW(xxhUnion.update(murmur), std::invalid_argument);
+    xxhUnion.update(single);
+    HllSketch* result = xxhUnion.getResult();
+    CPPUNIT_ASSERT_EQUAL(HashType::XXH3_128, result->getHashType());
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(single.getCompositeEstimate(), result->getCompositeEstimate(), 1e-6);
+    delete result;
+  }
+
+  void prehashed_update() {
+    const int n = 20000;
+    std::vector<int> coupons(n + 1);
+    HllSketch keyed(11, TgtHllType::HLL_4);
+    HllSketch hashed(11, TgtHllType::HLL_4);
+    for (int i = 0; i < n; ++i) {
+      const uint64_t key = i;
+      uint64_t hash[2];
+      MurmurHash3_x64_128(&key, sizeof(key), 9001, hash);
+      keyed.update(key);
+      hashed.update_hash(hash);
+      coupons[i] = HllSketch::coupon(hash);
+    }
+    coupons[n] = HllUtil::EMPTY; // skipped
+    CPPUNIT_ASSERT_EQUAL(keyed.getEstimate(), hashed.getEstimate());
+
+    HllSketch fromCoupons(11, TgtHllType::HLL_4);
+    fromCoupons.update_coupons(coupons.data(), coupons.size());
+    CPPUNIT_ASSERT_EQUAL(keyed.getEstimate(), fromCoupons.getEstimate());
+
+    HllUnion sketchUnion(11);
+    sketchUnion.update_coupons(coupons.data(), coupons.size());
+    CPPUNIT_ASSERT_EQUAL(keyed.getCompositeEstimate(), sketchUnion.getCompositeEstimate());
+
+    // the largest value sets the sign bit of the coupon
+    const uint64_t maxHash[2] = { 5, 0 };
+    const int maxCoupon = HllSketch::coupon(maxHash);
+    CPPUNIT_ASSERT_EQUAL(63, HllUtil::getValue(maxCoupon));
+    CPPUNIT_ASSERT_EQUAL(5, HllUtil::getLow26(maxCoupon));
+
+    const int badCoupon = 12345; // non-empty with a value of 0
+    HllSketch rejected(11, TgtHllType::HLL_8);
+    CPPUNIT_ASSERT_THROW(rejected.update_coupons(&badCoupon, 1), std::invalid_argument);
+    CPPUNIT_ASSERT(rejected.isEmpty());
+  }
+
+  void batch_update() {
+    // sizes chosen to cross LIST -> SET -> HLL partway through a block
+    const int n = 20000;
+    std::vector<uint64_t> longs(n);
+    std::vector<double> doubles(n);
+    std::vector<std::string> strings(n);
+    std::vector<std::string_view> views(n);
+    for (int i = 0; i < n; ++i) {
+      longs[i] = i;
+      doubles[i] = i * 0.5;
+      strings[i] = std::to_string(i);
+      views[i] = strings[i];
+    }
+
+    for (int lgK : {HllUtil::MIN_LOG_K, 7, 10, 14}) {
+      for (TgtHllType type : {TgtHllType::HLL_4, TgtHllType::HLL_8}) {
+        for (int len : {3, 100, n}) {
+          HllSketch single(lgK, type);
+          HllSketch batch(lgK, type);
+          for (int i = 0; i < len; ++i) { single.update(longs[i]); }
+          for (int i = 0; i < len; ++i) { single.update(doubles[i]); }
+          for (int i = 0; i < len; ++i) { single.update(strings[i]); }
+          batch.update(longs.data(), len);
+          batch.update(doubles.data(), len);
+          batch.update(views.data(), len);
+
+          CPPUNIT_ASSERT_EQUAL(single.getEstimate(), batch.getEstimate());
+          CPPUNIT_ASSERT_EQUAL(single.getCompositeEstimate(), batch.getCompositeEstimate());
+          CPPUNIT_ASSERT_EQUAL(single.getLowerBound(1), batch.getLowerBound(1));
+          CPPUNIT_ASSERT_EQUAL(single.getUpperBound(1), batch.getUpperBound(1));
+        }
+      }
+    }
+
+    // a large HLL_8 sketch in HLL mode takes the prefetching batch path
+    const int numLarge = 1 << 19;
+    std::vector<uint64_t> largeKeys(numLarge);
+    HllSketch single(HllUtil::MAX_LOG_K, TgtHllType::HLL_8);
+    HllSketch batch(HllUtil::MAX_LOG_K, TgtHllType::HLL_8);
+    for (int i = 0; i < numLarge; ++i) {
+      largeKeys[i] = i;
+      single.update(largeKeys[i]);
+    }
+    batch.update(largeKeys.data(), numLarge);
+    CPPUNIT_ASSERT_EQUAL(single.getEstimate(), batch.getEstimate());
+    CPPUNIT_ASSERT_EQUAL(single.getCompositeEstimate(), batch.getCompositeEstimate());
+  }
+
+  void decrement_nibbles() {
+    const int numBytes = 64;
+    uint8_t bytes[numBytes];
+    uint8_t expected[numBytes];
+    int expectedZeros = 0;
+    int expectedAux = 0;
+    for (int i = 0; i < numBytes; ++i) {
+      // nibbles 1 to 15, including some AUX_TOKENs
+      const int lo = 1 + ((i * 7) % 15);
+      const int hi = 1 + ((i * 11 + 3) % 15);
+      bytes[i] = (uint8_t) ((hi << 4) | lo);
+      const int newLo = (lo == HllUtil::AUX_TOKEN) ? lo : lo - 1;
+      const int newHi = (hi == HllUtil::AUX_TOKEN) ? hi : hi - 1;
+      expected[i] = (uint8_t) ((newHi << 4) | newLo);
+      expectedZeros += (newLo == 0) + (newHi == 0);
+      expectedAux += (lo == HllUtil::AUX_TOKEN) + (hi == HllUtil::AUX_TOKEN);
+    }
+
+    int numAux = -1;
+    CPPUNIT_ASSERT_EQUAL(expectedZeros, Hll4Array::decrementNibbles(bytes, numBytes, numAux));
+    CPPUNIT_ASSERT_EQUAL(expectedAux, numAux);
+    CPPUNIT_ASSERT(std::memcmp(expected, bytes, numBytes) == 0);
+
+    // the nibbles that just became zero cannot be decremented again
+    CPPUNIT_ASSERT_THROW(Hll4Array::decrementNibbles(bytes, numBytes, numAux), std::runtime_error);
+  }
+
+  void incremental_shift() {
+    const int lgK = 10;
+    const int k = 1 << lgK;
+    HllSketch eager(lgK, TgtHllType::HLL_4);
+    HllSketch incremental(lgK, TgtHllType::HLL_4);
+    incremental.putIncrementalShift(true);
+
+    // raise every register one value at a time so curMin keeps moving, with a few
+    // exceptions far above curMin that fit back into a nibble as it catches up
+    std::vector<int> coupons;
+    for (int slot = 0; slot < k; slot += 97) {
+      coupons.push_back(HllUtil::pair(slot, 20 + (slot % 15)));
+    }
+    for (int value = 1; value <= 30; ++value) {
+      for (int i = 0; i < k; ++i) {
+        coupons.push_back(HllUtil::pair((i * 389 + value) & (k - 1), value));
+      }
+    }
+    for (size_t i = 0; i < coupons.size(); ++i) {
+      eager.update_coupons(&coupons[i], 1);
+      incremental.update_coupons(&coupons[i], 1);
+      // a raised curMin leaves blocks behind for fewer than numBlocks (8) updates; unions
+      // read them as they are, also folded into a smaller gadget
+      if ((i % 7) == 0) {
+        for (int unionLgK : {lgK, 4, 6}) {
+          HllUnion eagerUnion(unionLgK);
+          HllUnion incrementalUnion(unionLgK);
+          eagerUnion.update(eager);
+          incrementalUnion.update(incremental);
+          std::unique_ptr<HllSketch> eagerResult(eagerUnion.getResult(TgtHllType::HLL_8));
+          std::unique_ptr<HllSketch> incrementalResult(
+              incrementalUnion.getResult(TgtHllType::HLL_8));
+          std::ostringstream eagerResultOs, incrementalResultOs;
+          eagerResult->to_string(eagerResultOs, true, true, false, true);
+          incrementalResult->to_string(incrementalResultOs, true, true, false, true);
+          CPPUNIT_ASSERT(eagerResultOs.str() == incrementalResultOs.str());
+        }
+      }
+      if ((i % 500) == 0) { // estimates settle the sketch
+        CPPUNIT_ASSERT_EQUAL(eager.getEstimate(), incremental.getEstimate());
+        CPPUNIT_ASSERT_EQUAL(eager.getCompositeEstimate(), incremental.getCompositeEstimate());
+        CPPUNIT_ASSERT_EQUAL(eager.getLowerBound(1), incremental.getLowerBound(1));
+      }
+    }
+
+    std::unique_ptr<HllSketch> copy(incremental.copy());
+    std::ostringstream eagerOs, incrementalOs, copyOs;
+    eager.to_string(eagerOs, true, true, false, true);
+    incremental.to_string(incrementalOs, true, true, false, true);
+    copy->to_string(copyOs, true, true, false, true);
+    CPPUNIT_ASSERT(eagerOs.str() == incrementalOs.str());
+    CPPUNIT_ASSERT(eagerOs.str() == copyOs.str());
+    CPPUNIT_ASSERT(copy->isIncrementalShift());
+
+    incremental.putIncrementalShift(false);
+    for (int i = 0; i < k; ++i) {
+      const int coupon = HllUtil::pair(i, 31);
+      eager.update_coupons(&coupon, 1);
+      incremental.update_coupons(&coupon, 1);
+    }
+    CPPUNIT_ASSERT_EQUAL(eager.getEstimate(), incremental.getEstimate());
+    CPPUNIT_ASSERT_EQUAL(eager.getCompositeEstimate(), incremental.getCompositeEstimate());
+  }
+
+  void estimate_cache() {
+    for (TgtHllType type : {TgtHllType::HLL_4, TgtHllType::HLL_8}) {
+      HllSketch sketch1(8, type);
+      HllSketch sketch2(8, type);
+      HllUnion sketchUnion(8);
+      for (uint64_t i = 0; i < 10000; ++i) {
+        sketch1.update(i);
+        sketch2.update(i + 5000);
+      }
+      sketchUnion.update(sketch1);
+      sketchUnion.update(sketch2);
+      std::unique_ptr<HllSketch> result(sketchUnion.getResult(type));
+      CPPUNIT_ASSERT(result->isOutOfOrderFlag());
+
+      // each way of changing the registers must drop the cached values
+      std::vector<uint64_t> keys(1000);
+      for (int round = 0; round < 3; ++round) {
+        const double estimate = result->getEstimate();
+        const double lowerBound = result->getLowerBound(2);
+        const double upperBound = result->getUpperBound(3);
+        CPPUNIT_ASSERT_EQUAL(estimate, result->getEstimate());
+        CPPUNIT_ASSERT_EQUAL(lowerBound, result->getLowerBound(2));
+
+        for (size_t i = 0; i < keys.size(); ++i) { keys[i] = 20000 * (round + 1) + i; }
+        if (round == 0) {
+          for (uint64_t key : keys) { result->update(key); }
+        } else if (round == 1) {
+          result->update(keys.data(), keys.size());
+        } else {
+          HllSketch other(8, type);
+          other.update(keys.data(), keys.size());
+          HllUnion merge(8);
+          merge.update(*result);
+          merge.update(other);
+          result.reset(merge.getResult(type));
+        }
+        std::unique_ptr<HllSketch> fresh(result->copy());
+        CPPUNIT_ASSERT(result->getEstimate() > estimate);
+        CPPUNIT_ASSERT(result->getUpperBound(3) > upperBound);
+        CPPUNIT_ASSERT_EQUAL(fresh->getEstimate(), result->getEstimate());
+        CPPUNIT_ASSERT_EQUAL(fresh->getLowerBound(2), result->getLowerBound(2));
+      }
+    }
+  }
+
+  void register_scan() {
+    // odd length to cover the tail, values past 63 stand for AUX_TOKEN slots and are skipped
+    std::vector<uint8_t> values(1003);
+    double expected0 = 0.0;
+    double expected1 = 0.0;
+    int expectedAt5 = 0;
+    for (size_t i = 0; i < values.size(); ++i) {
+      const int v = (i % 17 == 0) ? 0xff : (int) ((i * 37) % 64);
+      values[i] = (uint8_t) v;
+      if (v < 32)      { expected0 += HllUtil::invPow2(v); }
+      else if (v < 64) { expected1 += HllUtil::invPow2(v); }
+      expectedAt5 += (v == 5);
+    }
+    double kxq0, kxq1;
+    int numAt5;
+    RegisterScan::sumInvPow2(values.data(), (int) values.size(), 5, kxq0, kxq1, numAt5);
+    CPPUNIT_ASSERT_EQUAL(expected0, kxq0);
+    CPPUNIT_ASSERT_EQUAL(expected1, kxq1);
+    CPPUNIT_ASSERT_EQUAL(expectedAt5, numAt5);
+    CPPUNIT_ASSERT_EQUAL(0, RegisterScan::minValue(values.data(), (int) values.size()));
+    values[0] = 1;
+    for (uint8_t& v : values) { v = (uint8_t) std::max((int) v, 3); }
+    CPPUNIT_ASSERT_EQUAL(3, RegisterScan::minValue(values.data(), (int) values.size()));
+
+    // conversions and downsampling rebuild the same KxQ registers updates would have built
+    const int lgK = 12;
+    HllSketch sketch4(lgK, TgtHllType::HLL_4);
+    HllSketch sketch8(lgK, TgtHllType::HLL_8);
+    HllSketch small8(lgK - 2, TgtHllType::HLL_8);
+    for (uint64_t i = 0; i < 100000; ++i) {
+      sketch4.update(i);
+      sketch8.update(i);
+      small8.update(i);
+    }
+    std::unique_ptr<HllSketch> to4(sketch8.copyAs(TgtHllType::HLL_4));
+    std::unique_ptr<HllSketch> to8(sketch4.copyAs(TgtHllType::HLL_8));
+    CPPUNIT_ASSERT_EQUAL(sketch4.getCompositeEstimate(), to4->getCompositeEstimate());
+    CPPUNIT_ASSERT_EQUAL(sketch8.getCompositeEstimate(), to8->getCompositeEstimate());
+    CPPUNIT_ASSERT_EQUAL(sketch4.getLowerBound(1), to4->getLowerBound(1));
+
+    HllUnion downsampled(lgK - 2);
+    downsampled.update(sketch4);
+    std::unique_ptr<HllSketch> result(downsampled.getResult(TgtHllType::HLL_8));
+    CPPUNIT_ASSERT_EQUAL(small8.getCompositeEstimate(), result->getCompositeEstimate());
+  }
+
+  void union_hll8_merge() {
+    // HLL_8 sources are merged bytewise, HLL_4 sources slot by slot
+    const int lgK = 11;
+    HllUnion union8(lgK);
+    HllUnion union4(lgK);
+    for (int s = 0; s < 3; ++s) {
+      HllSketch sketch(lgK, TgtHllType::HLL_8);
+      for (uint64_t i = 0; i < 20000; ++i) { sketch.update(i * 3 + s); }
+      std::unique_ptr<HllSketch> sketch4(sketch.copyAs(TgtHllType::HLL_4));
+      union8.update(sketch);
+      union4.update(*sketch4);
+    }
+    std::unique_ptr<HllSketch> result8(union8.getResult(TgtHllType::HLL_8));
+    std::unique_ptr<HllSketch> result4(union4.getResult(TgtHllType::HLL_8));
+    CPPUNIT_ASSERT(result8->isOutOfOrderFlag());
+    CPPUNIT_ASSERT_EQUAL(result4->getEstimate(), result8->getEstimate());
+    CPPUNIT_ASSERT_EQUAL(result4->getLowerBound(2), result8->getLowerBound(2));
+  }
+
+  void union_hll4_merge() {
+    // HLL_4 sources with curMin above 0 and AuxHashMap exceptions, one of them unsettled
+    const int lgK = 9;
+    const int k = 1 << lgK;
+    HllSketch direct(lgK, TgtHllType::HLL_8);
+    HllUnion hllUnion(lgK);
+    for (int s = 0; s < 3; ++s) {
+      HllSketch sketch(lgK, TgtHllType::HLL_4);
+      sketch.putIncrementalShift(s == 2);
+      std::vector<int> coupons;
+      for (int value = 1; value <= 4 + s; ++value) {
+        for (int i = 0; i < k; ++i) {
+          coupons.push_back(HllUtil::pair(i, value + ((i * 7 + s) % 5)));
+        }
+      }
+      for (int i = s; i < k; i += 61) {
+        coupons.push_back(HllUtil::pair(i, 25 + s));
+      }
+      sketch.update_coupons(coupons.data(), coupons.size());
+      direct.update_coupons(coupons.data(), coupons.size());
+      hllUnion.update(sketch);
+    }
+    std::unique_ptr<HllSketch> result(hllUnion.getResult(TgtHllType::HLL_8));
+    CPPUNIT_ASSERT_EQUAL(direct.getCompositeEstimate(), result->getCompositeEstimate());
+  }
+
+  void union_downsample() {
+    // bigger sources of both types folded into an HLL gadget, and a smaller one shrinking it
+    HllSketch direct(9, TgtHllType::HLL_8);
+    HllUnion hllUnion(12);
+    const int lgKs[] = {11, 14, 16, 9, 13};
+    for (int s = 0; s < 5; ++s) {
+      HllSketch sketch(lgKs[s], (s % 2) ? TgtHllType::HLL_8 : TgtHllType::HLL_4);
+      for (uint64_t i = 0; i < 200000; ++i) {
+        sketch.update(i * 5 + s);
+        direct.update(i * 5 + s);
+      }
+      hllUnion.update(sketch);
+    }
+    std::unique_ptr<HllSketch> result(hllUnion.getResult(TgtHllType::HLL_8));
+    CPPUNIT_ASSERT_EQUAL(9, result->getLgConfigK());
+    CPPUNIT_ASSERT_EQUAL(direct.getCompositeEstimate(), result->getCompositeEstimate());
+  }
+
+  void parallel_union() {
+    std::vector<std::unique_ptr<HllSketch>> owned;
+    std::vector<HllSketch*> sketches;
+    for (int s = 0; s < 23; ++s) {
+      const int lgK = 10 + (s % 4);
+      owned.emplace_back(new HllSketch(lgK, (s % 3) ? TgtHllType::HLL_4 : TgtHllType::HLL_8));
+      const uint64_t n = (s == 5) ? 0 : 3000 + 1000 * s; // one empty sketch
+      for (uint64_t i = 0; i < n; ++i) { owned.back()->update(i * 23 + s); }
+      sketches.push_back(owned.back().get());
+    }
+    HllSketch small(12, TgtHllType::HLL_8); // LIST mode, forces the serial path
+    small.update("x");
+
+    for (bool withList : {false, true}) {
+      if (withList) { sketches.insert(sketches.begin() + 7, &small); }
+      HllUnion serial(12);
+      for (HllSketch* sketch : sketches) { serial.update(*sketch); }
+      std::unique_ptr<HllSketch> expected(serial.getResult(TgtHllType::HLL_8));
+      std::ostringstream expectedOs;
+      expected->to_string(expectedOs, true, true, false, true);
+      for (int numThreads : {1, 3, 8, 64}) {
+        HllUnion parallel(12);
+        parallel.update(sketches.data(), sketches.size(), numThreads);
+        std::unique_ptr<HllSketch> result(parallel.getResult(TgtHllType::HLL_8));
+        std::ostringstream resultOs;
+        result->to_string(resultOs, true, true, false, true);
+        CPPUNIT_ASSERT(expectedOs.str() == resultOs.str());
+        CPPUNIT_ASSERT_EQUAL(expected->getEstimate(), result->getEstimate());
+      }
+    }
+
+    // sketches and union on resources that are not thread safe, which only the calling
+    // thread may touch; run under -fsanitize=thread to catch a worker that does
+    {
+      std::pmr::unsynchronized_pool_resource pool;
+      CheckingResource unionResource;
+      std::vector<std::unique_ptr<HllSketch>> ownedPooled;
+      std::vector<HllSketch*> pooled;
+      for (int s = 0; s < 12; ++s) {
+        ownedPooled.emplace_back(new HllSketch(10 + (s % 3),
+            (s % 2) ? TgtHllType::HLL_4 : TgtHllType::HLL_8, HashType::MURMUR3, &pool));
+        pooled.push_back(ownedPooled.back().get());
+        if (s % 4 == 1) { pooled.back()->putIncrementalShift(true); }
+        for (uint64_t i = 0; i < 5000; ++i) { pooled.back()->update(i * 12 + s); }
+      }
+      HllUnion serial(12);
+      for (HllSketch* sketch : pooled) { serial.update(*sketch); }
+      {
+        HllUnion parallel(12, HashType::MURMUR3, &unionResource);
+        parallel.update(pooled.data(), pooled.size(), 4);
+        CPPUNIT_ASSERT_EQUAL(serial.getCompositeEstimate(), parallel.getCompositeEstimate());
+      }
+      CPPUNIT_ASSERT(unionResource.numAllocations > 0);
+      CPPUNIT_ASSERT(!unionResource.otherThread);
+      CPPUNIT_ASSERT(unionResource.blocks.empty());
+    }
+
+    HllSketch xxh(12, TgtHllType::HLL_8, HashType::XXH3_128);
+    sketches.push_back(&xxh);
+    HllUnion mixed(12);
+    CPPUNIT_ASSERT_THROW(mixed.update(sketches.data(), sketches.size(), 4),
+                         std::invalid_argument);
+    CPPUNIT_ASSERT(mixed.isEmpty());
+  }
+
+  void concurrent_sketch() {
+    // several writers with overlapping keys, through LIST, SET and HLL modes
+    const int numThreads = 4;
+    for (int lgK : {4, 10, 12}) {
+      for (uint64_t n : {6, 300, 20000}) {
+        ConcurrentHllSketch concurrent(lgK);
+        HllSketch serial(lgK, TgtHllType::HLL_8);
+        for (uint64_t i = 0; i < n; ++i) { serial.update(i); }
+        std::vector<std::thread> threads;
+        for (int t = 0; t < numThreads; ++t) {
+          threads.emplace_back([&concurrent, n, t]() {
+            for (uint64_t i = 0; i < n; ++i) { concurrent.update((i * 7 + t * n / 4) % n); }
+          });
+        }
+        for (std::thread& thread : threads) { thread.join(); }
+
+        if (n == 6)     { CPPUNIT_ASSERT_EQUAL(CurMode::LIST, concurrent.getCurMode()); }
+        if (n == 20000) { CPPUNIT_ASSERT_EQUAL(CurMode::HLL, concurrent.getCurMode()); }
+        CPPUNIT_ASSERT_EQUAL(serial.getCompositeEstimate(), concurrent.getEstimate());
+        std::unique_ptr<HllSketch> copy(concurrent.copyAsHllSketch());
+        CPPUNIT_ASSERT_EQUAL(serial.getCompositeEstimate(), copy->getCompositeEstimate());
+        HllUnion hllUnion(lgK);
+        hllUnion.update(*copy);
+        CPPUNIT_ASSERT_EQUAL(serial.getCompositeEstimate(), hllUnion.getCompositeEstimate());
+      }
+    }
+    // snapshots taken while writers keep promoting the table: a snapshot holds every key
+    // added before it began, so adding those keys again changes nothing
+    for (int round = 0; round < 20; ++round) {
+      const int lgK = 10 + (round % 3);
+      const uint64_t keysPerThread = 1000;
+      ConcurrentHllSketch concurrent(lgK);
+      std::vector<std::atomic<uint64_t>> numDone(numThreads);
+      std::vector<std::thread> threads;
+      for (int t = 0; t < numThreads; ++t) {
+        threads.emplace_back([&concurrent, &numDone, keysPerThread, t, round]() {
+          for (uint64_t i = 0; i < keysPerThread; ++i) {
+            concurrent.update((t * keysPerThread + i) * 31 + round);
+            numDone[t].store(i + 1);
+          }
+        });
+      }
+      bool writing = true;
+      while (writing) {
+        std::vector<uint64_t> before(numThreads);
+        writing = false;
+        for (int t = 0; t < numThreads; ++t) {
+          before[t] = numDone[t].load();
+          writing |= (before[t] < keysPerThread);
+        }
+        std::unique_ptr<HllSketch> snapshot(concurrent.copyAsHllSketch());
+        std::unique_ptr<HllSketch> readded(snapshot->copy());
+        for (int t = 0; t < numThreads; ++t) {
+          for (uint64_t i = 0; i < before[t]; ++i) {
+            readded->update((t * keysPerThread + i) * 31 + round);
+          }
+        }
+        std::ostringstream snapshotOs, readdedOs;
+        snapshot->to_string(snapshotOs, true, true, false, true);
+        readded->to_string(readdedOs, true, true, false, true);
+        CPPUNIT_ASSERT(snapshotOs.str() == readdedOs.str());
+      }
+      for (std::thread& thread : threads) { thread.join(); }
+    }
+
+    ConcurrentHllSketch empty(8);
+    CPPUNIT_ASSERT(empty.isEmpty());
+    empty.update(uint64_t(1));
+    CPPUNIT_ASSERT(!empty.isEmpty());
+    empty.reset();
+    CPPUNIT_ASSERT(empty.isEmpty());
+  }
+
+  void sharded_sketch() {
+    const int numThreads = 4;
+    for (int lgK : {4, 10, 12}) {
+      for (uint64_t n : {6, 300, 20000}) {
+        ShardedHllSketch sharded(lgK, TgtHllType::HLL_4, 1000);
+        HllSketch serial(lgK, TgtHllType::HLL_8);
+        for (uint64_t i = 0; i < n; ++i) { serial.update(i); }
+        std::vector<std::thread> threads;
+        for (int t = 0; t < numThreads; ++t) {
+          threads.emplace_back([&sharded, n, t]() {
+            for (uint64_t i = 0; i < n; ++i) { sharded.update((i * 7 + t * n / 4) % n); }
+          });
+        }
+        for (std::thread& thread : threads) { thread.join(); }
+
+        sharded.flush();
+        CPPUNIT_ASSERT_EQUAL(serial.getCompositeEstimate(), sharded.getCompositeEstimate());
+        std::unique_ptr<HllSketch> result(sharded.getResult(TgtHllType::HLL_8));
+        CPPUNIT_ASSERT_EQUAL(serial.getCompositeEstimate(), result->getCompositeEstimate());
+      }
+    }
+
+    // the background merge publishes without a flush
+    ShardedHllSketch sharded(12, TgtHllType::HLL_8, 5);
+    CPPUNIT_ASSERT(sharded.isEmpty());
+    std::thread([&sharded]() {
+      for (uint64_t i = 0; i < 1000; ++i) { sharded.update(i); }
+    }).join();
+    for (int i = 0; i < 400 && sharded.isEmpty(); ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    CPPUNIT_ASSERT_DOUBLES_EQUAL(1000, sharded.getEstimate(), 1000 * 0.05);
+    sharded.reset();
+    CPPUNIT_ASSERT(sharded.isEmpty());
+  }
+
+  void for_each_valid() {
+    // the same pairs as the virtual iterators, including HLL_4 exceptions above curMin
+    const int lgK = 8;
+    const int k = 1 << lgK;
+    Hll4Array hll4(lgK, std::pmr::get_default_resource());
+    Hll8Array hll8(lgK, std::pmr::get_default_resource());
+    for (int value = 1; value <= 3; ++value) {
+      for (int i = 0; i < k; i += (value == 1) ? 1 : 3) {
+        hll4.couponUpdate(HllUtil::pair(i, value));
+        hll8.couponUpdate(HllUtil::pair(i, value));
+      }
+    }
+    for (int i = 0; i < k; i += 17) {
+      hll4.couponUpdate(HllUtil::pair(i, 30));
+      hll8.couponUpdate(HllUtil::pair(i, 30));
+    }
+    CPPUNIT_ASSERT(hll4.getAuxHashMap() != nullptr);
+    for (HllArray* hllArr : std::initializer_list<HllArray*>{&hll4, &hll8}) {
+      std::vector<int> expected;
+      std::unique_ptr<PairIterator> itr = hllArr->getIterator();
+      while (itr->nextValid()) { expected.push_back(itr->getPair()); }
+      std::vector<int> visited;
+      auto collect = [&visited](const int slotNo, const int value) {
+        visited.push_back(HllUtil::pair(slotNo, value));
+      };
+      if (hllArr == &hll4) { hll4.forEachValid(collect); } else { hll8.forEachValid(collect); }
+      CPPUNIT_ASSERT(expected == visited);
+    }
+
+    int numAux = 0;
+    hll4.getAuxHashMap()->forEachEntry([&numAux](const int key, const int value) {
+      CPPUNIT_ASSERT_EQUAL(0, key % 17);
+      CPPUNIT_ASSERT_EQUAL(30, value);
+      ++numAux;
+    });
+    CPPUNIT_ASSERT_EQUAL(hll4.getAuxHashMap()->getAuxCount(), numAux);
+
+    CouponList list(lgK, TgtHllType::HLL_8, CurMode::LIST, std::pmr::get_default_resource());
+    for (int i = 0; i < 5; ++i) { list.couponUpdate(HllUtil::pair(i, 1)); }
+    std::vector<int> coupons;
+    list.forEachCoupon([&coupons](const int coupon) { coupons.push_back(coupon); });
+    CPPUNIT_ASSERT_EQUAL(5, (int) coupons.size());
+  }
+
+  void value_histogram() {
+    // enabled before, during and after updates, through curMin shifts and exceptions
+    const int lgK = 10;
+    const int k = 1 << lgK;
+    std::vector<int> coupons;
+    for (int value = 1; value <= 6; ++value) {
+      for (int i = 0; i < k; i += (value < 4) ? 1 : 5) {
+        coupons.push_back(HllUtil::pair((i * 37) % k, value + ((i * 11) % 3)));
+      }
+    }
+    for (int i = 0; i < k; i += 29) {
+      coupons.push_back(HllUtil::pair(i, 40));
+    }
+    const int half = coupons.size() / 2;
+    for (TgtHllType type : {TgtHllType::HLL_4, TgtHllType::HLL_8}) {
+      for (int when = 0; when < 3; ++when) {
+        std::pmr::memory_resource* resource = std::pmr::get_default_resource();
+        std::unique_ptr<HllArray> hllArr(HllArray::newHll(lgK, type, resource));
+        std::unique_ptr<HllArray> plain(HllArray::newHll(lgK, type, resource));
+        if (type == TgtHllType::HLL_4) { ((Hll4Array*) hllArr.get())->putIncrementalShift(when == 2); }
+        if (when != 1) { hllArr->putValueHistogram(true); }
+        int numApplied = 0;
+        hllArr->couponUpdate(coupons.data(), half, numApplied);
+        plain->couponUpdate(coupons.data(), half, numApplied);
+        if (when == 1) { hllArr->putValueHistogram(true); }
+        for (int i = half; i < (int) coupons.size(); ++i) {
+          hllArr->couponUpdate(coupons[i]);
+          plain->couponUpdate(coupons[i]);
+        }
+
+        std::vector<int> expected(HllUtil::VAL_MASK_6 + 1, 0);
+        std::unique_ptr<PairIterator> itr = hllArr->getIterator();
+        while (itr->nextAll()) { ++expected[itr->getValue()]; }
+        const int* histogram = hllArr->getValueHistogram();
+        CPPUNIT_ASSERT(histogram != nullptr);
+        CPPUNIT_ASSERT(std::equal(expected.begin(), expected.end(), histogram));
+        CPPUNIT_ASSERT_EQUAL(plain->getHipAccum(), hllArr->getHipAccum());
+        CPPUNIT_ASSERT_EQUAL(plain->getCompositeEstimate(), hllArr->getCompositeEstimate());
+
+        // the KxQ registers derived from the counts match a scan
+        hllArr->rebuildKxQ();
+        plain->rebuildKxQ();
+        CPPUNIT_ASSERT_EQUAL(plain->getKxQ0(), hllArr->getKxQ0());
+        CPPUNIT_ASSERT_EQUAL(plain->getKxQ1(), hllArr->getKxQ1());
+        CPPUNIT_ASSERT_EQUAL(plain->getNumAtCurMin(), hllArr->getNumAtCurMin());
+
+        std::unique_ptr<HllArray> copy(hllArr->copy());
+        CPPUNIT_ASSERT(std::equal(expected.begin(), expected.end(), copy->getValueHistogram()));
+        hllArr->putValueHistogram(false);
+        // incremental shifting keeps it
+        const bool kept = (when == 2) && (type == TgtHllType::HLL_4);
+        CPPUNIT_ASSERT_EQUAL(kept, hllArr->getValueHistogram() != nullptr);
+      }
+    }
+
+    HllSketch sketch(lgK, TgtHllType::HLL_4);
+    sketch.putValueHistogram(true);
+    HllSketch plain(lgK, TgtHllType::HLL_4);
+    for (uint64_t i = 0; i < 100000; ++i) {
+      sketch.update(i);
+      plain.update(i);
+    }
+    CPPUNIT_ASSERT_EQUAL(plain.getEstimate(), sketch.getEstimate());
+    std::unique_ptr<HllSketch> copy(sketch.copyAs(TgtHllType::HLL_8));
+    CPPUNIT_ASSERT(copy->isValueHistogram());
+  }
+
+  void improved_estimate() {
+    const int lgK = 11;
+    CPPUNIT_ASSERT_EQUAL(0.0, HllArray::hllImprovedEstimate(lgK, 1 << lgK, 1 << lgK, 0));
+    for (uint64_t n : {5, 1000, 3000, 50000, 1000000}) {
+      for (TgtHllType type : {TgtHllType::HLL_4, TgtHllType::HLL_8}) {
+        HllSketch sketch(lgK, type);
+        HllSketch withHistogram(lgK, type);
+        withHistogram.putValueHistogram(true);
+        for (uint64_t i = 0; i < n; ++i) {
+          sketch.update(i);
+          withHistogram.update(i);
+        }
+        if (n == 5) {
+          CPPUNIT_ASSERT_EQUAL(sketch.getEstimate(), sketch.getImprovedEstimate());
+        }
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(n, sketch.getImprovedEstimate(), n * 0.07);
+        CPPUNIT_ASSERT_EQUAL(sketch.getImprovedEstimate(), withHistogram.getImprovedEstimate());
+
+        HllUnion hllUnion(lgK);
+        hllUnion.putValueHistogram(true);
+        hllUnion.update(sketch);
+        CPPUNIT_ASSERT_EQUAL(sketch.getImprovedEstimate(), hllUnion.getImprovedEstimate());
+      }
+    }
+  }
+
+  void find_straddle() {
+    for (int lgK = HllUtil::MIN_LOG_K; lgK <= HllUtil::MAX_LOG_K; ++lgK) {
+      const double* xArr = CompositeInterpolationXTable::get_x_arr(lgK);
+      const int len = CompositeInterpolationXTable::get_x_arr_length(lgK);
+      for (int i = 0; i < len - 1; ++i) {
+        const double mid = (xArr[i] + xArr[i + 1]) / 2;
+        for (double x : {xArr[i], mid, std::nextafter(xArr[i + 1], 0.0)}) {
+          CPPUNIT_ASSERT_EQUAL(i, CompositeInterpolationXTable::find_straddle(lgK, x));
+        }
+      }
+      CPPUNIT_ASSERT_EQUAL(len - 2, CompositeInterpolationXTable::find_straddle(lgK, xArr[len - 1]));
+    }
+  }
+
+  void batch_estimates() {
+    // enough sketches for two threads, in every mode, type and order flag
+    const size_t numSketches = 40000;
+    std::vector<std::unique_ptr<HllSketch>> owned;
+    std::vector<HllSketch*> sketches;
+    for (size_t s = 0; s < numSketches; ++s) {
+      const int lgK = 4 + (s % 18);
+      const TgtHllType type = (s % 3 == 0) ? TgtHllType::HLL_4 : TgtHllType::HLL_8;
+      const int n = (s % 97 == 0) ? (s % 5000) * 3 : s % 40;
+      HllSketch* sketch = new HllSketch(lgK, type);
+      for (int i = 0; i < n; ++i) {
+        sketch->update((uint64_t) (s * 1000003 + i));
+      }
+      if (s % 7 == 0) {
+        HllUnion hllUnion(lgK);
+        hllUnion.update(*sketch);
+        delete sketch;
+        sketch = hllUnion.getResult(type);
+      }
+      owned.emplace_back(sketch);
+      sketches.push_back(sketch);
+    }
+
+    for (int numThreads : {1, 4}) {
+      std::vector<double> estimates(numSketches);
+      std::vector<double> lowerBounds(numSketches);
+      std::vector<double> upperBounds(numSketches);
+      HllSketch::getEstimates(sketches.data(), numSketches, 2, estimates.data(),
+                              lowerBounds.data(), upperBounds.data(), numThreads);
+      for (size_t s = 0; s < numSketches; ++s) {
+        CPPUNIT_ASSERT_EQUAL(sketches[s]->getEstimate(), estimates[s]);
+        CPPUNIT_ASSERT_EQUAL(sketches[s]->getLowerBound(2), lowerBounds[s]);
+        CPPUNIT_ASSERT_EQUAL(sketches[s]->getUpperBound(2), upperBounds[s]);
+      }
+    }
+
+    double estimate = 0;
+    HllSketch::getEstimates(sketches.data() + 97, 1, 3, &estimate, nullptr, nullptr, 1);
+    CPPUNIT_ASSERT_EQUAL(sketches[97]->getEstimate(), estimate);
+
+    // a few sketches, each many times over, queried from several threads with cold caches;
+    // run under -fsanitize=thread to catch a race on the cached estimates
+    std::vector<std::unique_ptr<HllSketch>> shared;
+    for (int s = 0; s < 8; ++s) {
+      const TgtHllType type = (s % 2) ? TgtHllType::HLL_4 : TgtHllType::HLL_8;
+      shared.emplace_back(new HllSketch(10 + (s % 3), type));
+      for (uint64_t i = 0; i < 20000; ++i) { shared.back()->update(i * 8 + s); }
+      if (s % 4 == 0) { // out of order, so the estimate is the cached composite one
+        HllUnion hllUnion(12);
+        hllUnion.update(*shared.back());
+        hllUnion.update(*shared.back()); // a second HLL merge sets the flag
+        shared.back().reset(hllUnion.getResult(type));
+        CPPUNIT_ASSERT(shared.back()->isOutOfOrderFlag());
+      }
+    }
+    std::vector<HllSketch*> repeated;
+    for (size_t s = 0; s < numSketches; ++s) { repeated.push_back(shared[s % 8].get()); }
+    std::vector<double> repeatedEstimates(numSketches);
+    std::thread querier([&shared]() {
+      for (const std::unique_ptr<HllSketch>& sketch : shared) {
+        sketch->getCompositeEstimate();
+        sketch->getLowerBound(1);
+        sketch->getUpperBound(3);
+      }
+    });
+    HllSketch::getEstimates(repeated.data(), numSketches, 1, repeatedEstimates.data(),
+                            nullptr, nullptr, 4);
+    querier.join();
+    for (size_t s = 0; s < numSketches; ++s) {
+      CPPUNIT_ASSERT_EQUAL(repeated[s]->getEstimate(), repeatedEstimates[s]);
+    }
+  }
+
+  // checks that every block is returned once, with the size and alignment it was allocated with
+  class CheckingResource : public std::pmr::memory_resource {
+    public:
+      std::map<void*, std::pair<size_t, size_t>> blocks;
+      size_t numAllocations = 0;
+      bool mismatch = false;
+      bool otherThread = false; // used by a thread other than the one that made it
+
+    private:
+      const std::thread::id owner = std::this_thread::get_id();
+
+      void* do_allocate(size_t bytes, size_t alignment) {
+        otherThread |= (std::this_thread::get_id() != owner);
+        void* p = std::pmr::new_delete_resource()->allocate(bytes, alignment);
+        blocks[p] = std::make_pair(bytes, alignment);
+        ++numAllocations;
+        return p;
+      }
+      void do_deallocate(void* p, size_t bytes, size_t alignment) {
+        otherThread |= (std::this_thread::get_id() != owner);
+        auto it = blocks.find(p);
+        if ((it == blocks.end()) || (it->second != std::make_pair(bytes, alignment))) {
+          mismatch = true;
+          return;
+        }
+        blocks.erase(it);
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+      }
+      bool do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+        return this == &other;
+      }
+  };
+
+  void memory_resource() {
+    CheckingResource resource;
+    CheckingResource unionResource;
+    {
+      // anything allocated outside the given resources throws
+      struct NullDefault {
+        std::pmr::memory_resource* previous =
+            std::pmr::set_default_resource(std::pmr::null_memory_resource());
+        ~NullDefault() { std::pmr::set_default_resource(previous); }
+      } nullDefault;
+
+      HllUnion hllUnion(12, HashType::MURMUR3, &unionResource);
+      for (TgtHllType type : {TgtHllType::HLL_4, TgtHllType::HLL_8}) {
+        HllSketch sketch(12, type, HashType::MURMUR3, &resource);
+        sketch.putValueHistogram(true);
+        for (int n : {5, 100, 20000}) {
+          for (int i = 0; i < n; ++i) { sketch.update((uint64_t) (i * 7919 + n)); }
+          std::unique_ptr<HllSketch> copy(sketch.copy());
+          std::unique_ptr<HllSketch> converted(sketch.copyAs(TgtHllType::HLL_8));
+          CPPUNIT_ASSERT(converted->getResource() == &resource);
+          CPPUNIT_ASSERT_EQUAL(sketch.getEstimate(), copy->getEstimate());
+          hllUnion.update(sketch);
+        }
+        if (type == TgtHllType::HLL_4) { sketch.putIncrementalShift(true); }
+        for (uint64_t i = 0; i < 100000; ++i) { sketch.update(i); }
+        hllUnion.update(sketch);
+        sketch.reset();
+        CPPUNIT_ASSERT(sketch.isEmpty());
+      }
+      std::unique_ptr<HllSketch> result(hllUnion.getResult(TgtHllType::HLL_4));
+      CPPUNIT_ASSERT(result->getResource() == &unionResource);
+    }
+
+    CPPUNIT_ASSERT(resource.numAllocations > 0);
+    CPPUNIT_ASSERT(unionResource.numAllocations > 0);
+    CPPUNIT_ASSERT(!resource.mismatch);
+    CPPUNIT_ASSERT(!unionResource.mismatch);
+    CPPUNIT_ASSERT(resource.blocks.empty());
+    CPPUNIT_ASSERT(unionResource.blocks.empty());
+  }
+
+  void sketch_pool() {
+    CheckingResource upstream;
+    {
+      HllSketchPool pool(&upstream);
+      for (int round = 0; round < 2; ++round) {
+        // mostly LIST, with some in SET and HLL modes, destroyed out of order
+        std::vector<HllSketch*> pooled;
+        for (int s = 0; s < 2000; ++s) {
+          const int lgK = (s % 3 == 0) ? 14 : 10;
+          const TgtHllType type = (s % 2 == 0) ? TgtHllType::HLL_4 : TgtHllType::HLL_8;
+          HllSketch* sketch = pool.newSketch(lgK, type);
+          HllSketch plain(lgK, type);
+          const int n = (s % 100 == 0) ? 5000 : s % 10;
+          for (int i = 0; i < n; ++i) {
+            sketch->update((uint64_t) (s * 100003 + i));
+            plain.update((uint64_t) (s * 100003 + i));
+          }
+          CPPUNIT_ASSERT(sketch->getResource() == pool.getResource());
+          CPPUNIT_ASSERT_EQUAL(plain.getEstimate(), sketch->getEstimate());
+          pooled.push_back(sketch);
+          if (s % 5 == 4) {
+            pool.destroySketch(pooled[s - 2]);
+            pooled[s - 2] = nullptr;
+          }
+        }
+        {
+          HllUnion hllUnion(12, HashType::MURMUR3, pool.getResource());
+          for (HllSketch* sketch : pooled) {
+            if (sketch != nullptr) { hllUnion.update(*sketch); }
+          }
+          CPPUNIT_ASSERT(hllUnion.getEstimate() > 0);
+        }
+        if (round == 0) {
+          pool.release(); // frees the rest without visiting them
+        } else {
+          for (HllSketch* sketch : pooled) {
+            if (sketch != nullptr) { pool.destroySketch(sketch); }
+          }
+        }
+      }
+    }
+    CPPUNIT_ASSERT(upstream.numAllocations > 0);
+    CPPUNIT_ASSERT(!upstream.mismatch);
+    CPPUNIT_ASSERT(upstream.blocks.empty());
+  }
+
+  template<int LgK, TgtHllType TgtType>
+  void check_static_sketch(const int n) {
+    StaticHllSketch<LgK, TgtType> fixed;
+    HllSketch dynamic(LgK, TgtType);
+    std::vector<uint64_t> longs(n);
+    for (int i = 0; i < n; ++i) {
+      longs[i] = i;
+      fixed.update((uint64_t) (n + i));
+      fixed.update(std::to_string(i));
+      dynamic.update((uint64_t) (n + i));
+      dynamic.update(std::to_string(i));
+    }
+    fixed.update(longs.data(), n);
+    dynamic.update(longs.data(), n);
+
+    CPPUNIT_ASSERT_EQUAL(dynamic.getEstimate(), fixed.getEstimate());
+    CPPUNIT_ASSERT_EQUAL(dynamic.getCompositeEstimate(), fixed.getCompositeEstimate());
+    CPPUNIT_ASSERT_EQUAL(dynamic.getLowerBound(2), fixed.getLowerBound(2));
+    CPPUNIT_ASSERT_EQUAL(dynamic.getUpperBound(2), fixed.getUpperBound(2));
+
+    StaticHllSketch<LgK, TgtType> copy(fixed);
+    std::unique_ptr<HllSketch> converted(fixed.copyAsHllSketch());
+    fixed.reset();
+    CPPUNIT_ASSERT(fixed.isEmpty());
+    CPPUNIT_ASSERT_EQUAL(dynamic.getEstimate(), copy.getEstimate());
+    CPPUNIT_ASSERT_EQUAL(dynamic.getEstimate(), converted->getEstimate());
+    CPPUNIT_ASSERT_EQUAL(dynamic.getCompositeEstimate(), converted->getCompositeEstimate());
+
+    HllUnion staticUnion(LgK);
+    HllUnion dynamicUnion(LgK);
+    staticUnion.update(copy);
+    dynamicUnion.update(dynamic);
+    CPPUNIT_ASSERT_EQUAL(dynamicUnion.getEstimate(), staticUnion.getEstimate());
+  }
+
+  void static_sketch() {
+    // counts chosen to finish in LIST, SET and HLL modes
+    for (int n : {2, 30, 5000}) {
+      check_static_sketch<HllUtil::MIN_LOG_K, TgtHllType::HLL_8>(n);
+      check_static_sketch<12, TgtHllType::HLL_8>(n);
+      check_static_sketch<7, TgtHllType::HLL_4>(n);
+      check_static_sketch<12, TgtHllType::HLL_4>(n);
+      check_static_sketch<HllUtil::MAX_LOG_K, TgtHllType::HLL_4>(n);
+    }
+  }
 
 };
 